@@ -24,13 +24,15 @@ int etherflow_close_socket_C();
 
 /***********************************************************
  * etherflow_send_reset_C()
- * what: send a reset Ethernet frame
+ * what: send a reset Ethernet frame, then wait for the
+ *       device to come out of reset: returns as soon as it
+ *       announces itself, or after timeout_ms
  * params:
- *    none
+ *    timeout_ms - bound on the wait
  * returns:
  *    return sendto error code
  **********************************************************/
-int etherflow_send_reset_C()
+int etherflow_send_reset_C(int timeout_ms);
 
 /***********************************************************
  * receive_frame_C()
@@ -55,6 +57,17 @@ unsigned char * etherflow_receive_frame_C(int *lengthp);
  **********************************************************/
 int etherflow_send_frame_C(short int length, const unsigned char * data_p);
 
+/***********************************************************
+ * set_credits()
+ * what: credit-based flow control for neuFlow->PC transfers:
+ *       a grant is sent every 'frames' frames received
+ * params:
+ *    frames - credit window, 0 disables flow control
+ * returns:
+ *    void
+ **********************************************************/
+void etherflow_set_credits(int frames);
+
 /***********************************************************
  * send_tensor_byte()
  * what: sends a torch byte tensor by breaking it down into
@@ -81,6 +94,20 @@ int etherflow_send_ByteTensor_C(unsigned char * data, int size);
 int etherflow_send_FloatTensor_C(float * data, int size);
 int etherflow_send_DoubleTensor_C(double * data, int size);
 
+/***********************************************************
+ * send_tensor_uint8()
+ * what: sends a torch tensor as one byte per element:
+ *       reals are converted to Q8.8 and clamped to [0,255],
+ *       so [0,1) is sent without loss. The device widens
+ *       each byte back to a Q8.8 word.
+ * params:
+ *    tensor - tensor to send
+ * returns:
+ *    void
+ **********************************************************/
+int etherflow_send_FloatTensor_uint8_C(float * data, int size);
+int etherflow_send_DoubleTensor_uint8_C(double * data, int size);
+
 /***********************************************************
  * receive_tensor_TYPE()
  * what: receives a torch tensor by concatenating eth packs
@@ -42,6 +42,13 @@
 #define ETH_FCS_LEN     4        /* Octets in the FCS               */
 #endif
 #define ETH_PACKET_DELAY_US 22
+// Default bound on the wait after a reset. The bootloader has no
+// request/ack to probe (a probe frame would be taken for bytecode), so
+// the reset only returns early if the device sends a frame once out of
+// reset: with a bitfile that stays silent, the wait is always the full
+// 6s of the old fixed sleep. Pass a lower bound to sendreset() for those.
+#define ETH_RESET_TIMEOUT_MS 6000
+#define ETH_RESET_PROBE_US  10000
 #define ETH_ADDR_REM (0x010203040506)
 #define ETH_TYPE     (0x1000)
 
@@ -316,23 +323,74 @@ int etherflow_close_socket_C() {
 #endif // _LINUX_
 }
 
+// sets a timeout on the reads, 0 for blocking reads
+static void etherflow_recv_timeout(int timeout_us) {
+  struct timeval tv;
+  tv.tv_sec = timeout_us / 1000000;
+  tv.tv_usec = timeout_us % 1000000;
+#ifdef _LINUX_
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#else // not _LINUX_ but _APPLE_
+  ioctl(bpf, BIOCSRTIMEOUT, &tv);
+#endif // _LINUX_
+}
+
+// drops the frames received so far
+static void etherflow_flush(void) {
+#ifdef _LINUX_
+  unsigned char buffer[ETH_FRAME_LEN];
+  while (recv(sock, buffer, ETH_FRAME_LEN, MSG_DONTWAIT) > 0);
+#else // not _LINUX_ but _APPLE_
+  ioctl(bpf, BIOCFLUSH);
+  bpf_ptr = (char*)bpf_buf;
+  bpf_read_bytes = 0;
+#endif // _LINUX_
+}
+
+// waits up to timeout_us for a frame from the device (dropped)
+static int etherflow_poll_device(int timeout_us) {
+  etherflow_recv_timeout(timeout_us);
+#ifdef _LINUX_
+  unsigned char buffer[ETH_FRAME_LEN];
+  int len = recv(sock, buffer, ETH_FRAME_LEN, 0);
+  if (len < 2*ETH_ALEN) return 0;
+  return (memcmp(buffer, host_mac, ETH_ALEN) == 0)
+      && (memcmp(buffer+ETH_ALEN, dest_mac, ETH_ALEN) == 0);
+#else // not _LINUX_ but _APPLE_
+  // the bpf filter only keeps frames from the device
+  bpf_read_bytes = read(bpf, bpf_buf, bpf_buf_len);
+  int got = (bpf_read_bytes > 0);
+  bpf_ptr = (char*)bpf_buf;
+  bpf_read_bytes = 0;
+  return got;
+#endif // _LINUX_
+}
+
 /***********************************************************
  * etherflow_send_reset_C()
- * what: send a reset Ethernet frame
+ * what: send a reset Ethernet frame, then wait for the
+ *       device to come out of reset: returns as soon as it
+ *       announces itself (any frame it sends), or after
+ *       timeout_ms if it stays silent
  * params:
- *    none
+ *    timeout_ms - bound on the wait
  * returns:
  *    return sendto error code
  **********************************************************/
-int etherflow_send_reset_C() {
+int etherflow_send_reset_C(int timeout_ms) {
   // reset mac addr
   unsigned char rst_mac[6] = {0x00,0x00,0x36,0x26,0x00,0x01};
   // buffer to send:
   unsigned char send_buffer[ETH_FRAME_LEN];
   int exitcode;
+  struct timeval t0, t1;
+  long elapsed_ms = 0;
 
   printf("<etherflow> reseting...\n");
 
+  // frames sent before the reset are not an announcement
+  etherflow_flush();
+
   // zero frame
   bzero(send_buffer, ETH_FRAME_LEN);
 
@@ -347,11 +405,52 @@ int etherflow_send_reset_C() {
   exitcode = write(bpf, send_buffer, ETH_FRAME_LEN);
 #endif // _LINUX_
 
-  usleep(6000000); // give time to the ml605 to come out of reset
+  // give time to the ml605 to come out of reset
+  gettimeofday(&t0, NULL);
+  while (elapsed_ms < timeout_ms) {
+    int ready = etherflow_poll_device(ETH_RESET_PROBE_US);
+    gettimeofday(&t1, NULL);
+    elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000;
+    if (ready) {
+      printf("<etherflow> device ready after %ld ms\n", elapsed_ms);
+      break;
+    }
+  }
+  etherflow_recv_timeout(0);
 
   return exitcode;
 }
 
+/***********************************************************
+ * set_credits()
+ * what: credit-based flow control for neuFlow->PC transfers:
+ *       the device sends up to 'frames' frames, then waits
+ *       for a grant. A grant is sent every 'frames' frames
+ *       received, so the device never waits for a round trip
+ *       while the host keeps up. The count restarts at each
+ *       call (after the bytecode is loaded).
+ * params:
+ *    frames - credit window, 0 disables flow control
+ * returns:
+ *    void
+ **********************************************************/
+static int credit_frames = 0;
+static int credit_count = 0;
+void etherflow_set_credits(int frames) {
+  credit_frames = frames;
+  credit_count = 0;
+}
+
+int etherflow_send_frame_C(short int length, const unsigned char * data_p);
+
+static void etherflow_credit_frame(void) {
+  if (credit_frames <= 0) return;
+  if (++credit_count == credit_frames) {
+    credit_count = 0;
+    etherflow_send_frame_C(64, (unsigned char *)"CREDIT--12345678123456781234567812345678123456781234567812345678");
+  }
+}
+
 /***********************************************************
  * receive_frame_C()
  * what: receives an ethernet frame
@@ -383,6 +482,7 @@ unsigned char * etherflow_receive_frame_C(int *lengthp) {
     /* } */
     if (accept) break;
   }
+  etherflow_credit_frame();
   if (lengthp != NULL) (*lengthp) = len;
   return recbuffer;
 }
@@ -412,6 +512,7 @@ unsigned char * etherflow_receive_frame_C(int *lengthp) {
   memcpy(recbuffer, (char*)bpf_packet + bpf_packet->bh_hdrlen, bpf_packet->bh_caplen);
   // Increment thr ptr message for the next read
   bpf_ptr += BPF_WORDALIGN(bpf_packet->bh_hdrlen + bpf_packet->bh_caplen);
+  etherflow_credit_frame();
   if (lengthp != NULL) (*lengthp) = bpf_packet->bh_caplen;
   return recbuffer;
 }
@@ -602,6 +703,35 @@ int etherflow_send_(Tensor_C)(real * data, int size) {
   return 0;
 }
 
+/***********************************************************
+ * send_tensor_uint8()
+ * what: sends a torch tensor as one byte per element
+ *       a tensor of reals is converted to Q8.8, and clamped
+ *       to [0,255] (the device widens bytes to Q8.8 words)
+ * params:
+ *    tensor - tensor to send
+ * returns:
+ *    void
+ **********************************************************/
+int etherflow_send_(Tensor_uint8_C)(real * data, int size) {
+  unsigned char *bytes = (unsigned char *)malloc(size);
+  int i;
+
+  // convert real -> Q8.8, low byte only
+  for (i = 0; i < size; i++) {
+    real fixed_point = data[i] * neuflow_one_encoding + 0.5;
+    if (fixed_point < 0) fixed_point = 0;
+    if (fixed_point > 255) fixed_point = 255;
+    bytes[i] = (unsigned char)fixed_point;
+  }
+
+  // descriptor + packets are handled as for bytes
+  etherflow_send_ByteTensor_C(bytes, size);
+  free(bytes);
+
+  return 0;
+}
+
 /***********************************************************
  * receive_tensor_TYPE()
  * what: receives a torch tensor by concatenating eth packs
@@ -686,6 +816,15 @@ static int etherflow_(Api_send_tensor_lua)(lua_State *L) {
   return 0;
 }
 
+static int etherflow_(Api_send_tensor_uint8_lua)(lua_State *L) {
+  /* get the arguments */
+  THTensor *tensor = luaT_toudata(L, 1, torch_(Tensor_id));
+  int size = THTensor_(nElement)(tensor);
+  real *data = THTensor_(data)(tensor);
+  etherflow_send_(Tensor_uint8_C)(data, size);
+  return 0;
+}
+
 static int etherflow_(Api_send_tensor_byte_lua)(lua_State *L) {
   // get params
   THByteTensor *tensor = luaT_toudata(L, 1, luaT_checktypename2id(L, "torch.ByteTensor"));
@@ -740,7 +879,8 @@ static int etherflow_(Api_open_socket_lua)(lua_State *L) {
 }
 
 static int etherflow_(Api_send_reset_lua)(lua_State *L) {
-  lua_pushnumber(L, etherflow_send_reset_C());
+  int timeout_ms = lua_isnumber(L, 1) ? lua_tointeger(L, 1) : ETH_RESET_TIMEOUT_MS;
+  lua_pushnumber(L, etherflow_send_reset_C(timeout_ms));
   return 1;
 }
 
@@ -787,6 +927,11 @@ static int etherflow_(Api_receive_frame_lua)(lua_State *L) {
   return 2;
 }
 
+static int etherflow_(Api_set_credits_lua)(lua_State *L) {
+  etherflow_set_credits(lua_tointeger(L, 1));
+  return 0;
+}
+
 static int etherflow_(Api_set_first_call)(lua_State *L) {
   /* get the arguments */
   int val = lua_tointeger(L, 1);
@@ -805,10 +950,12 @@ static const struct luaL_Reg etherflow_(Api__) [] = {
   {"receive_string", etherflow_(Api_receive_string_lua)},
   {"send_frame", etherflow_(Api_send_frame_lua)},
   {"send_tensor", etherflow_(Api_send_tensor_lua)},
+  {"send_tensor_uint8", etherflow_(Api_send_tensor_uint8_lua)},
   {"send_bytetensor", etherflow_(Api_send_tensor_byte_lua)},
   {"receive_tensor", etherflow_(Api_receive_tensor_lua)},
   {"close_socket", etherflow_(Api_close_socket_lua)},
   {"set_first_call", etherflow_(Api_set_first_call)},
+  {"set_credits", etherflow_(Api_set_credits_lua)},
   {NULL, NULL}
 };
 
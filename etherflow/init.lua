@@ -41,14 +41,22 @@ function etherflow.close(dev)
    etherflow.double.close_socket()
 end
 
-function etherflow.sendreset()
-   return etherflow.double.send_reset()
+-- timeout: bound on the wait for the device (seconds), 6s by default
+function etherflow.sendreset(timeout)
+   return etherflow.double.send_reset(timeout and math.ceil(timeout*1000))
 end
 
 function etherflow.handshake(bool)
    etherflow.double.handshake(bool)
 end
 
+-- credit-based flow control: a grant every 'frames' frames received
+-- (0 disables it); off while the bytecode is loaded, then restarted
+function etherflow.credits(frames)
+   etherflow.credit_frames = frames
+   etherflow.double.set_credits(frames)
+end
+
 function etherflow.sendstring(str)
    etherflow.double.send_frame(str)
 end
@@ -65,12 +73,27 @@ function etherflow.sendtensor(tensor)
    tensor.etherflow.send_tensor(tensor)
 end
 
+-- one byte per element: byte tensors are sent as is, real tensors
+-- are converted to Q8.8 and clamped to [0,255]
+function etherflow.sendtensor8(tensor)
+   if torch.typename(tensor) == 'torch.ByteTensor' then
+      etherflow.double.send_bytetensor(tensor)
+   else
+      tensor.etherflow.send_tensor_uint8(tensor)
+   end
+end
+
 function etherflow.receivetensor(tensor)
    tensor.etherflow.receive_tensor(tensor)
 end
 
 function etherflow.loadbytecode(bytetensor)
+   -- no grants while the bootloader receives the program: frames counted
+   -- in a previous run would put one in the middle of the bytecode
+   etherflow.double.set_credits(0)
    etherflow.double.send_bytetensor(bytetensor)
+   -- the program now runs: the next frame received is its first one
+   etherflow.double.set_credits(etherflow.credit_frames or 0)
 end
 
 function etherflow.setfirstcall(val)
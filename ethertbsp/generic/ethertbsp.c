@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include <sys/time.h>
+#include <sys/select.h>
 #ifdef _LINUX_
 
 #include <linux/if_packet.h>
@@ -49,6 +50,9 @@
 #define ETH_FCS_LEN     4        /* Octets in the FCS               */
 #endif // _LINUX_
 #define ETH_PACKET_DELAY_US 170
+#define TBSP_RESET_TIMEOUT_MS  1000 // default bound on the wait after a reset
+#define TBSP_RESET_INTERVAL_MS 100  // the reset packet is sent again after that
+#define TBSP_PROBE_US          10000
 #define ETH_ADDR_REM (0x008010640000)
 #define ETH_TYPE     (0x88b5)
 
@@ -335,6 +339,33 @@ int network_recv_packet() {
 }
 
 
+// receives a packet within timeout_us, returns 1 if one came. Only these
+// receives time out: the timeout is cleared on return, and
+// network_recv_packet() alone still blocks until a packet comes
+int network_poll_packet(int timeout_us) {
+  struct timeval tv;
+  int got;
+  tv.tv_sec = timeout_us / 1000000;
+  tv.tv_usec = timeout_us % 1000000;
+#ifdef _LINUX_
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  got = (0 == network_recv_packet());
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#else // not _LINUX_ but _APPLE_
+  // the bpf filter only keeps packets from the device
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(bpf, &fds);
+  got = (bpf_ptr < ((char*)(bpf_buf) + bpf_read_bytes))
+     || (select(bpf+1, &fds, NULL, NULL, &tv) > 0);
+  if (got) got = (0 == network_recv_packet());
+#endif // _LINUX_
+  return got;
+}
+
+
 int network_send_packet() {
   struct timeval current;
   int bytesent;
@@ -573,40 +604,57 @@ int network_open_socket(const char *dev) {
  * TBSP Communication Functions
  */
 
-int tbsp_send_reset() {
-  int xx;
+static long tbsp_elapsed_ms(struct timeval *since) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000;
+}
+
+// resets the board, then probes it with req packets until it acks
+// from sequence 0, for timeout_ms at most
+int tbsp_send_reset(int timeout_ms) {
+  struct timeval start;
+  long reset_ms = -TBSP_RESET_INTERVAL_MS;
+  int ready = 0;
 
   printf("<send reset>\n");
 
-  for (xx = 0; xx < 10; xx++) {
-    // send reset packet
-    bzero(send_packet.tbsp_type, tbsp_header_length);
-    tbsp_write_type(&send_packet, TBSP_RESET);
-    network_send_packet();
+  // drop the packets sent before the reset
+  while (network_poll_packet(1000));
 
-    // A delay to give the pico board time to come out of reset.
-    usleep(10000);
+  gettimeofday(&start, NULL);
+  do {
+    // send reset packet (again, if it was lost)
+    if (tbsp_elapsed_ms(&start) - reset_ms >= TBSP_RESET_INTERVAL_MS) {
+      bzero(send_packet.tbsp_type, tbsp_header_length);
+      tbsp_write_type(&send_packet, TBSP_RESET);
+      network_send_packet();
+      reset_ms = tbsp_elapsed_ms(&start);
+    }
 
     // send req packet
     bzero(send_packet.tbsp_type, tbsp_header_length);
     tbsp_write_type(&send_packet, TBSP_REQ);
     network_send_packet();
 
-    // recv packet
-    network_recv_packet();
-
-    if (TBSP_ACK == tbsp_read_type(&recv_packet)) {
-      if ((0 == tbsp_read_1st_seq_position(&recv_packet))
-        & (0 == tbsp_read_2nd_seq_position(&recv_packet))) {
-
-        current_send_seq_pos = 0;
-        current_recv_seq_pos = 0;
-        return 0;
+    // recv packet: the board answers once it is out of reset
+    while (!ready && network_poll_packet(TBSP_PROBE_US)) {
+      if (TBSP_ACK == tbsp_read_type(&recv_packet)) {
+        ready = (0 == tbsp_read_1st_seq_position(&recv_packet))
+              & (0 == tbsp_read_2nd_seq_position(&recv_packet));
       }
     }
-  }
+  } while (!ready && tbsp_elapsed_ms(&start) < timeout_ms);
+
+  if (!ready) return -1;
 
-  return -1;
+  // acks to the earlier probes
+  while (network_poll_packet(TBSP_PROBE_US));
+  printf("<send reset> board ready after %ld ms\n", tbsp_elapsed_ms(&start));
+
+  current_send_seq_pos = 0;
+  current_recv_seq_pos = 0;
+  return 0;
 }
 
 
@@ -904,7 +952,8 @@ static int ethertbsp_(Api_close_socket_lua)(lua_State *L) {
 
 
 static int ethertbsp_(Api_send_reset_lua)(lua_State *L) {
-  lua_pushnumber(L, tbsp_send_reset());
+  int timeout_ms = lua_isnumber(L, 1) ? lua_tointeger(L, 1) : TBSP_RESET_TIMEOUT_MS;
+  lua_pushnumber(L, tbsp_send_reset(timeout_ms));
   return 1;
 }
 
@@ -42,8 +42,9 @@ function ethertbsp.close(dev)
    ethertbsp.double.close_socket()
 end
 
-function ethertbsp.sendreset()
-   return ethertbsp.double.send_reset()
+-- timeout: bound on the wait for the board (seconds), 1s by default
+function ethertbsp.sendreset(timeout)
+   return ethertbsp.double.send_reset(timeout and math.ceil(timeout*1000))
 end
 
 function ethertbsp.sendtensor(tensor)
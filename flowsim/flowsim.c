@@ -0,0 +1,1392 @@
+/***********************************************************
+ * flowsim - an instruction-level simulator of neuFlow
+ **********************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flowsim.h"
+
+#define FS_SUB_WORDS    32       /* config words kept per submodule */
+#define FS_MAX_KERNELS  8        /* kernels registered per convolver */
+#define FS_NB_LINES     8        /* global lines (4 bits) */
+#define FS_Z            15       /* undriven line */
+#define FS_IDLE_POLLS   100000   /* status polls before WAIT_RX */
+#define FS_ETH_DATA_LEN 1500     /* max payload */
+#define FS_ETH_MIN_LEN  64       /* min payload */
+
+#define FS_OK           0
+#define FS_NOT_READY    1
+#define FS_FAILED       2
+
+/* conv modes (see Core:configTile) */
+#define FS_CONV_SAMESIZE  1
+#define FS_CONV_ACCOUTPUT 2
+#define FS_CONV_SUBOUTPUT 4
+#define FS_CONV_USEBIAS   8
+
+/* combiner ops (see Core:send_combinerConfig) */
+#define FS_COMB_MAC     1
+#define FS_COMB_DIV     2
+#define FS_COMB_MUL     3
+#define FS_COMB_ADD     4
+#define FS_COMB_SUB     5
+#define FS_COMB_SQUARE  6
+
+enum { FS_CONV = 1, FS_COMB, FS_MAPP };
+enum { FS_NORTH = 0, FS_EAST, FS_SOUTH, FS_WEST };
+
+/***********************************************************
+ * internal state
+ **********************************************************/
+typedef struct {
+  uint32_t live[FS_SUB_WORDS];
+  uint32_t shadow[FS_SUB_WORDS];   /* written in cache mode */
+  int count;                       /* words since last select */
+  int caching;
+} fs_sub;
+
+typedef struct {
+  int16_t *data;
+  long len;
+} fs_stream;
+
+typedef struct {
+  int kind;
+  int column;
+  int addr;
+  int active;
+  fs_sub sub[4];
+  fs_stream kernels[FS_MAX_KERNELS];
+  int nb_kernels;
+  fs_stream pending;               /* last stream on the kernel line */
+  fs_stream out[3];                /* valid for one evaluation */
+  long epoch;
+  int visiting;
+} fs_tile;
+
+typedef struct {
+  fs_sub sub[3];
+  int status;
+  int active;
+  int read;
+  long cursor;                     /* bytes moved by the CPU */
+  fs_stream stream;                /* valid for one evaluation */
+  long epoch;
+} fs_port;
+
+typedef struct {
+  unsigned char *data;
+  long size;
+  long cap;
+  long head;
+} fs_buffer;
+
+struct flowsim_t {
+  flowsim_params p;
+  unsigned char *mem;
+
+  /* CPU */
+  uint32_t regs[16];
+  long pc;
+  int halted;
+  int route_active;
+  long route_left;
+
+  /* config bus */
+  int area, addr, sub;
+
+  /* streamer and grid */
+  fs_port *ports;
+  fs_tile *tiles;
+  int nb_tiles;
+  fs_tile *tile_at[FLOWSIM_ADDR_GRID_0];
+  long epoch;
+  void **arena;
+  int arena_size, arena_cap;
+  int touched[FS_NB_LINES];
+  int nb_touched;
+
+  /* I/Os */
+  fs_buffer uart, uart_out;
+  fs_buffer rx;
+  fs_buffer tx;
+  fs_buffer frames;
+  int tx_busy;
+  long idle_polls;
+  long timer_start;
+  char timer_ascii[16];
+  int timer_pos;
+  uint32_t gpios;
+
+  /* host side */
+  int first_call;
+  int handshake;
+  int credit_frames;           /* credit window, 0: no flow control */
+  int credit_count;            /* frames received in the window */
+
+  flowsim_stats stats;
+  char error[256];
+};
+
+/***********************************************************
+ * helpers
+ **********************************************************/
+static int fs_fail(flowsim_t *sim, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(sim->error, sizeof(sim->error), fmt, args);
+  va_end(args);
+  return FS_FAILED;
+}
+
+static int fs_nibble(uint32_t word, int i)
+{
+  return (word >> (4*i)) & 0xF;
+}
+
+static int16_t fs_sat(int64_t v)
+{
+  if (v > 32767) return 32767;
+  if (v < -32768) return -32768;
+  return (int16_t)v;
+}
+
+/* products are accumulated at full precision, and truncated (floor)
+   back to the fixed point format at the output */
+static int64_t fs_shift(int64_t v, int frac)
+{
+  if (v >= 0) return v >> frac;
+  return -((-v + (((int64_t)1 << frac) - 1)) >> frac);
+}
+
+static int fs_buffer_append(fs_buffer *buf, const unsigned char *data, long n)
+{
+  if (buf->size + n > buf->cap) {
+    long cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->size + n) cap *= 2;
+    unsigned char *grown = realloc(buf->data, cap);
+    if (!grown) return -1;
+    buf->data = grown;
+    buf->cap = cap;
+  }
+  if (data) memcpy(buf->data + buf->size, data, n);
+  else memset(buf->data + buf->size, 0, n);
+  buf->size += n;
+  return 0;
+}
+
+static long fs_buffer_pending(fs_buffer *buf)
+{
+  return buf->size - buf->head;
+}
+
+static long fs_buffer_take(fs_buffer *buf, unsigned char *dest, long n)
+{
+  long avail = fs_buffer_pending(buf);
+  if (n > avail) n = avail;
+  if (dest) memcpy(dest, buf->data + buf->head, n);
+  buf->head += n;
+  if (buf->head == buf->size) {
+    buf->head = 0;
+    buf->size = 0;
+  } else if (buf->head > 1024*1024 && buf->head > buf->size/2) {
+    memmove(buf->data, buf->data + buf->head, buf->size - buf->head);
+    buf->size -= buf->head;
+    buf->head = 0;
+  }
+  return n;
+}
+
+static void fs_buffer_free(fs_buffer *buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof(*buf));
+}
+
+static int16_t *fs_alloc(flowsim_t *sim, long n)
+{
+  if (sim->arena_size == sim->arena_cap) {
+    int cap = sim->arena_cap ? 2*sim->arena_cap : 64;
+    void **grown = realloc(sim->arena, cap*sizeof(void*));
+    if (!grown) return NULL;
+    sim->arena = grown;
+    sim->arena_cap = cap;
+  }
+  int16_t *data = calloc(n > 0 ? n : 1, sizeof(int16_t));
+  if (data) sim->arena[sim->arena_size++] = data;
+  return data;
+}
+
+static void fs_arena_clear(flowsim_t *sim)
+{
+  int i;
+  for (i = 0; i < sim->arena_size; i++) free(sim->arena[i]);
+  sim->arena_size = 0;
+}
+
+static void fs_sub_clear(fs_sub *sub, uint32_t value)
+{
+  int i;
+  for (i = 0; i < FS_SUB_WORDS; i++) {
+    sub->live[i] = value;
+    sub->shadow[i] = value;
+  }
+  sub->count = 0;
+  sub->caching = 0;
+}
+
+static void fs_sub_write(fs_sub *sub, uint32_t word)
+{
+  if (sub->count < FS_SUB_WORDS) {
+    if (sub->caching) sub->shadow[sub->count] = word;
+    else sub->live[sub->count] = word;
+  }
+  sub->count++;
+}
+
+/***********************************************************
+ * external memory
+ **********************************************************/
+static int16_t fs_mem_read(flowsim_t *sim, long word)
+{
+  long a = word * sim->p.word_b;
+  if (a < 0 || a + 1 >= sim->p.mem_size_b) return 0;
+  return (int16_t)(sim->mem[a] | (sim->mem[a+1] << 8));
+}
+
+static void fs_mem_write(flowsim_t *sim, long word, int16_t value)
+{
+  long a = word * sim->p.word_b;
+  if (a < 0 || a + 1 >= sim->p.mem_size_b) return;
+  sim->mem[a] = (uint16_t)value & 0xFF;
+  sim->mem[a+1] = ((uint16_t)value >> 8) & 0xFF;
+}
+
+/***********************************************************
+ * streamer ports: globals = offset, length, stride shift,
+ * continuous; locals = x, y, w, h, mode (1 = read)
+ **********************************************************/
+static long fs_port_words(fs_port *port)
+{
+  return (long)port->sub[FLOWSIM_SUB_LOCALS].live[2] * port->sub[FLOWSIM_SUB_LOCALS].live[3];
+}
+
+static long fs_port_address(fs_port *port, long i)
+{
+  fs_sub *g = &port->sub[FLOWSIM_SUB_GLOBALS];
+  fs_sub *l = &port->sub[FLOWSIM_SUB_LOCALS];
+  long w = l->live[2] ? l->live[2] : 1;
+  return (long)g->live[0] + (((long)l->live[1] + i / w) << g->live[2]) + l->live[0] + i % w;
+}
+
+static void fs_port_reset(fs_port *port)
+{
+  int s;
+  for (s = 0; s < 3; s++) fs_sub_clear(&port->sub[s], 0);
+  port->status = FLOWSIM_STATUS_UNCONFIGURED;
+  port->active = 0;
+  port->read = 0;
+  port->cursor = 0;
+  port->epoch = 0;
+}
+
+static void fs_tile_reset(fs_tile *tile)
+{
+  int k;
+  fs_sub_clear(&tile->sub[FLOWSIM_SUB_ROUTER], 0xFFFFFFFF);
+  fs_sub_clear(&tile->sub[FLOWSIM_SUB_IO], 0xFFFFFFFF);
+  fs_sub_clear(&tile->sub[FLOWSIM_SUB_OPERATOR], 0);
+  fs_sub_clear(&tile->sub[FLOWSIM_SUB_CACHER], 0);
+  tile->sub[FLOWSIM_SUB_OPERATOR].count = 0;
+  for (k = 0; k < tile->nb_kernels; k++) free(tile->kernels[k].data);
+  tile->nb_kernels = 0;
+  free(tile->pending.data);
+  tile->pending.data = NULL;
+  tile->pending.len = 0;
+  tile->active = 0;
+  tile->epoch = 0;
+}
+
+/***********************************************************
+ * grid evaluation
+ *
+ * Lines are resolved backwards, from a write port to the
+ * read ports, with the encodings of Core:configTile():
+ *   IO word 1, nibble g: source of global line g
+ *       (0-7: global line, 8-10: local write line)
+ *   IO word 2, nibble k: global line read on local line k
+ *   router word 1, nibble i: source of operator input i
+ *   router word 2, nibbles 0-2: source of local write
+ *       lines, nibbles 3-6: source of n/e/s/w outputs
+ *   sources: 0-2 operator output, 8-10 local read line,
+ *       11-14 n/e/s/w neighbour, 15 undriven
+ **********************************************************/
+static int fs_resolve(flowsim_t *sim, fs_tile *tile, int src, fs_stream *out);
+
+static int fs_read_port(flowsim_t *sim, int line, fs_stream *out)
+{
+  int p = sim->p.grid_port_0 + line;
+  if (line >= FS_NB_LINES || p >= sim->p.nb_ports)
+    return fs_fail(sim, "global line %d has no port", line);
+  fs_port *port = &sim->ports[p];
+  if (!port->active || !port->read) return FS_NOT_READY;
+  if (port->epoch != sim->epoch) {
+    if (port->status == FLOWSIM_STATUS_DONE) return FS_NOT_READY;
+    long n = fs_port_words(port), i;
+    int16_t *data = fs_alloc(sim, n);
+    if (!data) return fs_fail(sim, "out of memory");
+    for (i = 0; i < n; i++) data[i] = fs_mem_read(sim, fs_port_address(port, i));
+    port->stream.data = data;
+    port->stream.len = n;
+    port->epoch = sim->epoch;
+  }
+  if (sim->nb_touched < FS_NB_LINES) sim->touched[sim->nb_touched++] = p;
+  *out = port->stream;
+  return FS_OK;
+}
+
+static int fs_local_read(flowsim_t *sim, fs_tile *tile, int k, fs_stream *out)
+{
+  int line = fs_nibble(tile->sub[FLOWSIM_SUB_IO].live[1], k);
+  if (line == FS_Z) return FS_NOT_READY;
+  return fs_read_port(sim, line, out);
+}
+
+/* neighbour wiring, as used by the tile chains of CoreUser:
+   conv(i).s -> comb(i).n, conv(i).e -> mapp(i).n,
+   comb(i).e -> mapp(i).w, mapp(i).e -> comb(i+1).w */
+static fs_tile *fs_neighbour(flowsim_t *sim, fs_tile *tile, int dir, int *out_dir)
+{
+  int addr = -1;
+  if (tile->kind == FS_COMB && dir == FS_NORTH) {
+    addr = FLOWSIM_ADDR_CONV_0 + tile->column; *out_dir = FS_SOUTH;
+  } else if (tile->kind == FS_MAPP && dir == FS_NORTH) {
+    addr = FLOWSIM_ADDR_CONV_0 + tile->column; *out_dir = FS_EAST;
+  } else if (tile->kind == FS_MAPP && dir == FS_WEST) {
+    addr = FLOWSIM_ADDR_COMB_0 + tile->column; *out_dir = FS_EAST;
+  } else if (tile->kind == FS_COMB && dir == FS_WEST && tile->column > 0) {
+    addr = FLOWSIM_ADDR_MAPP_0 + tile->column - 1; *out_dir = FS_EAST;
+  }
+  if (addr < 0) return NULL;
+  return sim->tile_at[addr];
+}
+
+static int fs_operator_input(flowsim_t *sim, fs_tile *tile, int i, fs_stream *in)
+{
+  int src = fs_nibble(tile->sub[FLOWSIM_SUB_ROUTER].live[0], i);
+  in->data = NULL;
+  in->len = 0;
+  if (src == FS_Z) return FS_OK;
+  if (src < 8) return fs_fail(sim, "tile %d: invalid source %d for operator input %d",
+                              tile->addr, src, i);
+  return fs_resolve(sim, tile, src, in);
+}
+
+static int fs_conv(flowsim_t *sim, fs_tile *tile, fs_stream *in)
+{
+  uint32_t *cfg = tile->sub[FLOWSIM_SUB_OPERATOR].live;
+  long W = cfg[0] >> 16, H = cfg[0] & 0xFFFF;
+  long kw = cfg[1] >> 16, kh = cfg[1] & 0xFFFF;
+  int mode = cfg[2] & 0xFFFF;
+  long sw = (cfg[2] >> 16) & 0xFF, sh = (cfg[2] >> 24) & 0xFF;
+  long KW = sim->p.kernel_w, KH = sim->p.kernel_h;
+  long oh, ow, pad_h = 0, pad_w = 0, r, c, i, j;
+  int frac = sim->p.frac;
+
+  if (tile->sub[FLOWSIM_SUB_OPERATOR].count < 3)
+    return fs_fail(sim, "convolver %d is not configured", tile->column);
+  if (tile->nb_kernels == 0)
+    return fs_fail(sim, "convolver %d has no kernel registered", tile->column);
+  if (kw > KW || kh > KH || kw == 0 || kh == 0)
+    return fs_fail(sim, "convolver %d: invalid kernel %ldx%ld", tile->column, kh, kw);
+  if (!in[0].data || in[0].len < W*H)
+    return fs_fail(sim, "convolver %d: input stream shorter than %ldx%ld", tile->column, H, W);
+
+  /* kernels are stored in the bottom-left corner of the kernel
+     buffer, after the bias (see Memory:allocEmbeddedData) */
+  fs_stream *kernel = &tile->kernels[tile->nb_kernels-1];
+  long base = (kernel->len == KH*KW+1) ? 1 : 0;
+  if (kernel->len - base < KH*KW)
+    return fs_fail(sim, "convolver %d: kernel stream too short", tile->column);
+  int64_t bias = ((mode & FS_CONV_USEBIAS) && base) ? kernel->data[0] : 0;
+  int16_t *weights = kernel->data + base + (KH-kh)*KW;
+
+  if (mode & FS_CONV_SAMESIZE) {
+    oh = H; ow = W; sh = 1; sw = 1;
+    pad_h = (kh-1)/2; pad_w = (kw-1)/2;
+  } else if (mode & FS_CONV_SUBOUTPUT) {
+    if (sh == 0 || sw == 0) return fs_fail(sim, "convolver %d: null stride", tile->column);
+    oh = (H-kh)/sh + 1; ow = (W-kw)/sw + 1;
+  } else {
+    oh = H-kh+1; ow = W-kw+1; sh = 1; sw = 1;
+  }
+  if (oh <= 0 || ow <= 0)
+    return fs_fail(sim, "convolver %d: kernel larger than input", tile->column);
+  if ((mode & FS_CONV_ACCOUTPUT) && (!in[2].data || in[2].len < oh*ow))
+    return fs_fail(sim, "convolver %d: accumulated stream shorter than %ldx%ld",
+                   tile->column, oh, ow);
+
+  int16_t *out = fs_alloc(sim, oh*ow);
+  if (!out) return fs_fail(sim, "out of memory");
+  for (i = 0; i < oh; i++) {
+    for (j = 0; j < ow; j++) {
+      int64_t acc = bias << frac;
+      for (r = 0; r < kh; r++) {
+        long y = i*sh + r - pad_h;
+        if (y < 0 || y >= H) continue;
+        for (c = 0; c < kw; c++) {
+          long x = j*sw + c - pad_w;
+          if (x < 0 || x >= W) continue;
+          acc += (int64_t)in[0].data[y*W + x] * weights[r*KW + c];
+        }
+      }
+      if (mode & FS_CONV_ACCOUTPUT) acc += (int64_t)in[2].data[i*ow + j] << frac;
+      out[i*ow + j] = fs_sat(fs_shift(acc, frac));
+    }
+  }
+
+  /* the subsampled result is on output 2, the accumulated one on 3 */
+  int o = (mode & FS_CONV_ACCOUTPUT) ? 2 : ((mode & FS_CONV_SUBOUTPUT) ? 1 : 0);
+  tile->out[o].data = out;
+  tile->out[o].len = oh*ow;
+  return FS_OK;
+}
+
+/* piecewise linear mapping: y = a*x + b, on the last segment
+   starting below x; odd/even functions are evaluated on |x| */
+static int fs_mapper(flowsim_t *sim, fs_tile *tile, fs_stream *in)
+{
+  uint32_t *cfg = tile->sub[FLOWSIM_SUB_OPERATOR].live;
+  int nsegs = 0, s;
+  long i;
+  int frac = sim->p.frac;
+
+  if (tile->sub[FLOWSIM_SUB_OPERATOR].count < 2)
+    return fs_fail(sim, "mapper %d is not configured", tile->column);
+  if (!in[0].data)
+    return fs_fail(sim, "mapper %d: input 1 is not connected", tile->column);
+  for (s = 0; s < sim->p.mapper_segs && 2*s+1 < FS_SUB_WORDS; s++) {
+    if (s == 0 || cfg[2*s] || cfg[2*s+1]) nsegs = s+1;
+  }
+  int even = (cfg[1] >> 16) & 1;
+  int odd = (cfg[1] >> 17) & 1;
+
+  int16_t *out = fs_alloc(sim, in[0].len);
+  if (!out) return fs_fail(sim, "out of memory");
+  for (i = 0; i < in[0].len; i++) {
+    int64_t x = in[0].data[i];
+    int negate = 0;
+    if ((odd || even) && x < 0) {
+      x = -x;
+      negate = odd;
+    }
+    int seg = 0;
+    for (s = 1; s < nsegs; s++) {
+      if ((int16_t)(cfg[2*s+1] & 0xFFFF) <= x) seg = s;
+    }
+    int64_t a = (int16_t)(cfg[2*seg] & 0xFFFF);
+    int64_t b = (int16_t)(cfg[2*seg] >> 16);
+    int64_t y = fs_sat(fs_shift(a*x, frac) + b);
+    out[i] = fs_sat(negate ? -y : y);
+  }
+  tile->out[0].data = out;
+  tile->out[0].len = in[0].len;
+  return FS_OK;
+}
+
+static int fs_combiner(flowsim_t *sim, fs_tile *tile, fs_stream *in)
+{
+  int op = tile->sub[FLOWSIM_SUB_OPERATOR].live[0] & 0xFF;
+  int frac = sim->p.frac;
+  long n, i;
+
+  if (tile->sub[FLOWSIM_SUB_OPERATOR].count < 1)
+    return fs_fail(sim, "ALU %d is not configured", tile->addr);
+  if (!in[0].data || (op != FS_COMB_SQUARE && !in[1].data))
+    return fs_fail(sim, "ALU %d: operator inputs are not connected", tile->addr);
+  n = in[0].len;
+  if (op != FS_COMB_SQUARE && in[1].len < n) n = in[1].len;
+  if (op == FS_COMB_MAC && in[2].data && in[2].len < n) n = in[2].len;
+
+  int16_t *out = fs_alloc(sim, n);
+  if (!out) return fs_fail(sim, "out of memory");
+  for (i = 0; i < n; i++) {
+    int64_t x = in[0].data[i];
+    int64_t y = in[1].data ? in[1].data[i] : 0;
+    int64_t r;
+    switch (op) {
+    case FS_COMB_MAC:
+      r = fs_shift(x*y, frac) + (in[2].data ? in[2].data[i] : 0);
+      break;
+    case FS_COMB_DIV:
+      if (y == 0) r = (x >= 0) ? 32767 : -32768;
+      else r = (x * ((int64_t)1 << frac)) / y;
+      break;
+    case FS_COMB_MUL:    r = fs_shift(x*y, frac); break;
+    case FS_COMB_ADD:    r = x + y; break;
+    case FS_COMB_SUB:    r = x - y; break;
+    case FS_COMB_SQUARE: r = fs_shift(x*x, frac); break;
+    default:
+      return fs_fail(sim, "ALU %d: unknown operator %d", tile->addr, op);
+    }
+    out[i] = fs_sat(r);
+  }
+  tile->out[0].data = out;
+  tile->out[0].len = n;
+  return FS_OK;
+}
+
+static int fs_operator_output(flowsim_t *sim, fs_tile *tile, int o, fs_stream *out)
+{
+  if (tile->epoch != sim->epoch) {
+    fs_stream in[3];
+    int i, rc;
+    if (tile->visiting) return fs_fail(sim, "combinational loop through tile %d", tile->addr);
+    tile->visiting = 1;
+    for (i = 0; i < 3; i++) {
+      rc = fs_operator_input(sim, tile, i, &in[i]);
+      if (rc != FS_OK) {
+        tile->visiting = 0;
+        return rc;
+      }
+    }
+    memset(tile->out, 0, sizeof(tile->out));
+    if (tile->kind == FS_CONV) rc = fs_conv(sim, tile, in);
+    else if (tile->kind == FS_MAPP) rc = fs_mapper(sim, tile, in);
+    else rc = fs_combiner(sim, tile, in);
+    tile->visiting = 0;
+    if (rc != FS_OK) return rc;
+    tile->epoch = sim->epoch;
+  }
+  if (!tile->out[o].data)
+    return fs_fail(sim, "tile %d produces nothing on output %d", tile->addr, o+1);
+  *out = tile->out[o];
+  return FS_OK;
+}
+
+static int fs_resolve(flowsim_t *sim, fs_tile *tile, int src, fs_stream *out)
+{
+  if (src <= 2) return fs_operator_output(sim, tile, src, out);
+  if (src >= 8 && src <= 10) return fs_local_read(sim, tile, src-8, out);
+  if (src >= 11 && src <= 14) {
+    int out_dir;
+    fs_tile *next = fs_neighbour(sim, tile, src-11, &out_dir);
+    if (!next) return fs_fail(sim, "tile %d has no neighbour on side %d", tile->addr, src-11);
+    return fs_resolve(sim, next, fs_nibble(next->sub[FLOWSIM_SUB_ROUTER].live[1], 3+out_dir), out);
+  }
+  return FS_NOT_READY;
+}
+
+static int fs_global_line(flowsim_t *sim, int line, fs_stream *out)
+{
+  fs_tile *driver = NULL;
+  int t, src = FS_Z;
+  for (t = 0; t < sim->nb_tiles; t++) {
+    int v = fs_nibble(sim->tiles[t].sub[FLOWSIM_SUB_IO].live[0], line);
+    if (v == FS_Z) continue;
+    if (driver) return fs_fail(sim, "global line %d is driven by tiles %d and %d",
+                               line, driver->addr, sim->tiles[t].addr);
+    driver = &sim->tiles[t];
+    src = v;
+  }
+  if (!driver) return FS_NOT_READY;
+  if (src < FS_NB_LINES) return fs_read_port(sim, src, out);
+  if (src >= 8 && src <= 10)
+    return fs_resolve(sim, driver, fs_nibble(driver->sub[FLOWSIM_SUB_ROUTER].live[1], src-8), out);
+  return fs_fail(sim, "tile %d: invalid source %d for global line %d", driver->addr, src, line);
+}
+
+static int fs_capture_kernels(flowsim_t *sim)
+{
+  int p, t, k;
+  for (p = sim->p.grid_port_0; p < sim->p.nb_ports; p++) {
+    fs_port *port = &sim->ports[p];
+    int line = p - sim->p.grid_port_0;
+    if (!port->active || !port->read || port->status != FLOWSIM_STATUS_BUSY) continue;
+    for (t = 0; t < sim->nb_tiles; t++) {
+      fs_tile *tile = &sim->tiles[t];
+      if (tile->kind != FS_CONV) continue;
+      for (k = 0; k < 3; k++) {
+        fs_stream s;
+        if (fs_nibble(tile->sub[FLOWSIM_SUB_IO].live[1], k) != line) continue;
+        if (fs_nibble(tile->sub[FLOWSIM_SUB_ROUTER].live[0], 1) != 8+k) continue;
+        if (fs_read_port(sim, line, &s) != FS_OK) return FS_FAILED;
+        free(tile->pending.data);
+        tile->pending.data = malloc(s.len*sizeof(int16_t) + 1);
+        if (!tile->pending.data) return fs_fail(sim, "out of memory");
+        memcpy(tile->pending.data, s.data, s.len*sizeof(int16_t));
+        tile->pending.len = s.len;
+        port->status = FLOWSIM_STATUS_DONE;
+      }
+    }
+  }
+  return FS_OK;
+}
+
+/* runs every stream that can run: all the write ports whose
+   sources are active are completed */
+static int fs_settle(flowsim_t *sim)
+{
+  int p, i, rc = FS_OK;
+  sim->epoch++;
+  sim->nb_touched = 0;
+  if (fs_capture_kernels(sim) != FS_OK) rc = FS_FAILED;
+
+  for (p = sim->p.grid_port_0; rc == FS_OK && p < sim->p.nb_ports; p++) {
+    fs_port *port = &sim->ports[p];
+    fs_stream s;
+    if (!port->active || port->read || port->status != FLOWSIM_STATUS_BUSY) continue;
+    sim->nb_touched = 0;
+    int r = fs_global_line(sim, p - sim->p.grid_port_0, &s);
+    if (r == FS_NOT_READY) continue;
+    if (r != FS_OK) { rc = r; break; }
+    long n = fs_port_words(port);
+    if (s.len != n) {
+      rc = fs_fail(sim, "port %d expects %ld words, the grid produced %ld", p, n, s.len);
+      break;
+    }
+    for (i = 0; i < n; i++) fs_mem_write(sim, fs_port_address(port, i), s.data[i]);
+    sim->stats.grid_words += n;
+    port->status = FLOWSIM_STATUS_DONE;
+    for (i = 0; i < sim->nb_touched; i++) sim->ports[sim->touched[i]].status = FLOWSIM_STATUS_DONE;
+  }
+  fs_arena_clear(sim);
+  return rc;
+}
+
+/***********************************************************
+ * config bus
+ **********************************************************/
+static int fs_port_instruction(flowsim_t *sim, fs_port *port, int instr)
+{
+  switch (instr) {
+  case FLOWSIM_INSTR_RESET:
+    fs_port_reset(port);
+    break;
+  case FLOWSIM_INSTR_ACTIVATE:
+    port->active = 1;
+    port->cursor = 0;
+    port->epoch = 0;
+    port->status = fs_port_words(port) ? FLOWSIM_STATUS_BUSY : FLOWSIM_STATUS_DONE;
+    break;
+  case FLOWSIM_INSTR_DEACTIVATE:
+    port->active = 0;
+    port->status = FLOWSIM_STATUS_IDLE;
+    break;
+  case FLOWSIM_INSTR_CONTROL_1:
+    if (port->read) port->status = FLOWSIM_STATUS_PRIMED;
+    break;
+  }
+  return FS_OK;
+}
+
+static int fs_tile_instruction(flowsim_t *sim, fs_tile *tile, int instr)
+{
+  int k;
+  switch (instr) {
+  case FLOWSIM_INSTR_RESET:
+    fs_tile_reset(tile);
+    break;
+  case FLOWSIM_INSTR_ACTIVATE:
+    tile->active = 1;
+    break;
+  case FLOWSIM_INSTR_DEACTIVATE:
+    tile->active = 0;
+    break;
+  case FLOWSIM_INSTR_CONTROL_0:
+    /* register the kernel streamed on input 2 */
+    if (tile->kind == FS_CONV && tile->pending.data) {
+      if (tile->nb_kernels == FS_MAX_KERNELS)
+        return fs_fail(sim, "convolver %d: kernel cache overflow", tile->column);
+      tile->kernels[tile->nb_kernels++] = tile->pending;
+      tile->pending.data = NULL;
+      tile->pending.len = 0;
+    }
+    break;
+  case FLOWSIM_INSTR_CONTROL_1:
+    /* discard the oldest kernel */
+    if (tile->kind == FS_CONV && tile->nb_kernels > 0) {
+      free(tile->kernels[0].data);
+      for (k = 1; k < tile->nb_kernels; k++) tile->kernels[k-1] = tile->kernels[k];
+      tile->nb_kernels--;
+    }
+    break;
+  case FLOWSIM_INSTR_CACHESTART:
+    tile->sub[sim->sub & 3].caching = 1;
+    break;
+  case FLOWSIM_INSTR_CACHEFINISH: {
+    fs_sub *sub = &tile->sub[sim->sub & 3];
+    if (sub->caching) {
+      memcpy(sub->live, sub->shadow, sizeof(sub->live));
+      sub->caching = 0;
+    }
+    break;
+  }
+  }
+  return FS_OK;
+}
+
+/* applies fn to the selected module(s): broadcast and group
+   addresses select all of them */
+static int fs_bus_instruction(flowsim_t *sim, int instr)
+{
+  int i, rc = FS_OK;
+  if (sim->area == FLOWSIM_AREA_STREAMER) {
+    if (instr == FLOWSIM_INSTR_DEACTIVATE || instr == FLOWSIM_INSTR_RESET)
+      if (fs_settle(sim) != FS_OK) return FS_FAILED;
+    if (sim->addr == FLOWSIM_ADDR_BROADCAST) {
+      for (i = 0; i < sim->p.nb_ports && rc == FS_OK; i++)
+        rc = fs_port_instruction(sim, &sim->ports[i], instr);
+    } else if (sim->addr-1 < sim->p.nb_ports) {
+      rc = fs_port_instruction(sim, &sim->ports[sim->addr-1], instr);
+    }
+  } else if (sim->area == FLOWSIM_AREA_TILE) {
+    if (instr == FLOWSIM_INSTR_DEACTIVATE || instr == FLOWSIM_INSTR_RESET)
+      if (fs_settle(sim) != FS_OK) return FS_FAILED;
+    if (sim->addr == FLOWSIM_ADDR_BROADCAST || sim->addr >= FLOWSIM_ADDR_GRID_0) {
+      for (i = 0; i < sim->nb_tiles && rc == FS_OK; i++)
+        rc = fs_tile_instruction(sim, &sim->tiles[i], instr);
+    } else if (sim->tile_at[sim->addr]) {
+      rc = fs_tile_instruction(sim, sim->tile_at[sim->addr], instr);
+    }
+  }
+  return rc;
+}
+
+static void fs_select(flowsim_t *sim, uint32_t word)
+{
+  int i;
+  sim->area = word >> 28;
+  sim->addr = (word >> 16) & 0xFFF;
+  sim->sub = (word >> 8) & 0xFF;
+  if (sim->area == FLOWSIM_AREA_STREAMER) {
+    for (i = 0; i < sim->p.nb_ports; i++) sim->ports[i].sub[sim->sub % 3].count = 0;
+  } else if (sim->area == FLOWSIM_AREA_TILE) {
+    for (i = 0; i < sim->nb_tiles; i++) sim->tiles[i].sub[sim->sub & 3].count = 0;
+  }
+}
+
+static int fs_port_config(flowsim_t *sim, fs_port *port, uint32_t word)
+{
+  fs_sub *sub = &port->sub[sim->sub % 3];
+  fs_sub_write(sub, word);
+  if (sim->sub == FLOWSIM_SUB_LOCALS && sub->count == 5) {
+    port->read = (sub->live[4] == 1);
+    if (!port->active) port->status = FLOWSIM_STATUS_IDLE;
+  }
+  return FS_OK;
+}
+
+static int fs_bus_config(flowsim_t *sim, uint32_t word)
+{
+  int i;
+  if (sim->area == FLOWSIM_AREA_STREAMER) {
+    if (sim->addr == FLOWSIM_ADDR_BROADCAST) {
+      for (i = 0; i < sim->p.nb_ports; i++) fs_port_config(sim, &sim->ports[i], word);
+    } else if (sim->addr-1 < sim->p.nb_ports) {
+      fs_port_config(sim, &sim->ports[sim->addr-1], word);
+    }
+  } else if (sim->area == FLOWSIM_AREA_TILE) {
+    /* streams run with the config they were started with */
+    if (fs_settle(sim) != FS_OK) return FS_FAILED;
+    if (sim->addr == FLOWSIM_ADDR_BROADCAST || sim->addr >= FLOWSIM_ADDR_GRID_0) {
+      for (i = 0; i < sim->nb_tiles; i++) fs_sub_write(&sim->tiles[i].sub[sim->sub & 3], word);
+    } else if (sim->tile_at[sim->addr]) {
+      fs_sub_write(&sim->tile_at[sim->addr]->sub[sim->sub & 3], word);
+    }
+  }
+  return FS_OK;
+}
+
+static int fs_write_config(flowsim_t *sim, int content, uint32_t word)
+{
+  sim->stats.config_words++;
+  switch (content) {
+  case FLOWSIM_CONTENT_COMMAND:
+    fs_select(sim, word);
+    if ((word & 0xFF) != FLOWSIM_INSTR_CONFIG) return fs_bus_instruction(sim, word & 0xFF);
+    return FS_OK;
+  case FLOWSIM_CONTENT_INSTRUC:
+    return fs_bus_instruction(sim, word & 0xFF);
+  case FLOWSIM_CONTENT_CONFIG:
+    return fs_bus_config(sim, word);
+  }
+  return FS_OK;
+}
+
+static int fs_get_status(flowsim_t *sim, int status)
+{
+  static const char *names[] = {"not addressed", "idle", "busy", "done",
+                                "primed", "unconfigured", "misconfigured"};
+  if (sim->area != FLOWSIM_AREA_STREAMER || sim->addr == FLOWSIM_ADDR_BROADCAST
+      || sim->addr-1 >= sim->p.nb_ports) return FS_OK;
+  if (fs_settle(sim) != FS_OK) return FS_FAILED;
+  fs_port *port = &sim->ports[sim->addr-1];
+  if (port->status == status) return FS_OK;
+  return fs_fail(sim, "deadlock: port %d is %s, waiting for %s", sim->addr-1,
+                 names[port->status % 7], names[status % 7]);
+}
+
+/***********************************************************
+ * I/Os: streams are moved byte by byte
+ **********************************************************/
+static int fs_dma(flowsim_t *sim, int write, unsigned char *bytes, long n)
+{
+  fs_port *port = &sim->ports[sim->p.dma_port];
+  long total = fs_port_words(port) * sim->p.word_b, i;
+  if (!port->active || port->read == write)
+    return fs_fail(sim, "io_dma: port %d is not open for %s", sim->p.dma_port,
+                   write ? "writing" : "reading");
+  for (i = 0; i < n; i++, port->cursor++) {
+    if (port->cursor >= total) {
+      /* overflowing bytes are dropped, and read as zeros */
+      if (!write) bytes[i] = 0;
+      continue;
+    }
+    long word = port->cursor / sim->p.word_b;
+    long a = fs_port_address(port, word)*sim->p.word_b + port->cursor % sim->p.word_b;
+    if (a < 0 || a >= sim->p.mem_size_b) continue;
+    if (write) sim->mem[a] = bytes[i];
+    else bytes[i] = sim->mem[a];
+  }
+  if (port->cursor >= total) port->status = FLOWSIM_STATUS_DONE;
+  return FS_OK;
+}
+
+static int fs_emit_frame(flowsim_t *sim, long length)
+{
+  unsigned char header[4];
+  header[0] = length & 0xFF;
+  header[1] = (length >> 8) & 0xFF;
+  header[2] = (length >> 16) & 0xFF;
+  header[3] = (length >> 24) & 0xFF;
+  if (fs_buffer_append(&sim->frames, header, 4)) return fs_fail(sim, "out of memory");
+  long avail = fs_buffer_pending(&sim->tx);
+  long n = avail < length ? avail : length;
+  if (fs_buffer_append(&sim->frames, sim->tx.data + sim->tx.head, n)
+      || fs_buffer_append(&sim->frames, NULL, length - n))
+    return fs_fail(sim, "out of memory");
+  fs_buffer_take(&sim->tx, NULL, n);
+  sim->stats.eth_tx_b += length;
+  sim->stats.eth_frames++;
+  sim->tx_busy = 1;
+  sim->idle_polls = 0;
+  return FS_OK;
+}
+
+/* returns the nb of bytes available (less than n only for an
+   empty Ethernet receive queue), or -1 on error */
+static long fs_io_source(flowsim_t *sim, int io, unsigned char *bytes, long n)
+{
+  long i;
+  switch (io) {
+  case FLOWSIM_IO_ETH:
+    n = fs_buffer_take(&sim->rx, bytes, n);
+    if (n > 0) sim->idle_polls = 0;
+    return n;
+  case FLOWSIM_IO_DMA:
+    return (fs_dma(sim, 0, bytes, n) == FS_OK) ? n : -1;
+  case FLOWSIM_IO_TIMER:
+    for (i = 0; i < n; i++) {
+      char c = sim->timer_ascii[sim->timer_pos];
+      bytes[i] = c;
+      if (c) sim->timer_pos++;
+    }
+    return n;
+  default:
+    memset(bytes, 0, n);
+    return n;
+  }
+}
+
+/* elements narrower than a streamer word are zero-extended by the
+   DMA IO: a uint8 element is one word */
+static int fs_io_sink(flowsim_t *sim, int io, unsigned char *bytes, long n, int esize)
+{
+  long i;
+  switch (io) {
+  case FLOWSIM_IO_UART:
+    if (fs_buffer_append(&sim->uart, bytes, n)) return fs_fail(sim, "out of memory");
+    return FS_OK;
+  case FLOWSIM_IO_ETH:
+    if (fs_buffer_append(&sim->tx, bytes, n)) return fs_fail(sim, "out of memory");
+    return FS_OK;
+  case FLOWSIM_IO_DMA:
+    if (esize < sim->p.word_b) {
+      for (i = 0; i < n; i++) {
+        unsigned char word[2] = {bytes[i], 0};
+        if (fs_dma(sim, 1, word, 2) != FS_OK) return FS_FAILED;
+      }
+      return FS_OK;
+    }
+    return fs_dma(sim, 1, bytes, n);
+  default:
+    /* io_uart_status is used as /dev/null */
+    return FS_OK;
+  }
+}
+
+static int fs_io_read_word(flowsim_t *sim, int io, uint32_t *value)
+{
+  unsigned char bytes[4];
+  fs_port *dma = &sim->ports[sim->p.dma_port];
+  long dma_total = fs_port_words(dma) * sim->p.word_b;
+  *value = 0;
+  switch (io) {
+  case FLOWSIM_IO_UART_STATUS:
+    *value = 2;                      /* tx ready, no rx data */
+    break;
+  case FLOWSIM_IO_DMA:
+    if (fs_dma(sim, 0, bytes, 4) != FS_OK) return FS_FAILED;
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    break;
+  case FLOWSIM_IO_DMA_STATUS:
+    if (dma->active && dma->cursor < dma_total) *value = dma->read ? 1 : 2;
+    break;
+  case FLOWSIM_IO_ETH_STATUS:
+    /* a transfer is seen busy once, then done */
+    *value = (sim->tx_busy ? 1 : 0) | (fs_buffer_pending(&sim->rx) ? 2 : 0);
+    if (!sim->tx_busy && !fs_buffer_pending(&sim->rx)) sim->idle_polls++;
+    sim->tx_busy = 0;
+    break;
+  case FLOWSIM_IO_GPIOS:
+    *value = sim->gpios;
+    break;
+  case FLOWSIM_IO_TIMER:
+    *value = (uint32_t)(sim->stats.cycles - sim->timer_start);
+    break;
+  }
+  return FS_OK;
+}
+
+static int fs_io_write_word(flowsim_t *sim, int io, uint32_t value)
+{
+  unsigned char bytes[4];
+  bytes[0] = value & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = (value >> 24) & 0xFF;
+  switch (io) {
+  case FLOWSIM_IO_UART:
+    return fs_io_sink(sim, io, bytes, 1, 1);
+  case FLOWSIM_IO_ETH:
+  case FLOWSIM_IO_DMA:
+    return fs_io_sink(sim, io, bytes, 4, 4);
+  case FLOWSIM_IO_ETH_STATUS:
+    /* start a transfer: length in the upper half word */
+    if (value & 1) return fs_emit_frame(sim, value >> 16);
+    return FS_OK;
+  case FLOWSIM_IO_TIMER_CTRL:
+    if (value & 1) sim->timer_start = sim->stats.cycles;
+    if (value & 2) {
+      snprintf(sim->timer_ascii, sizeof(sim->timer_ascii), "%09ld",
+               (sim->stats.cycles - sim->timer_start) % 1000000000L);
+      sim->timer_pos = 0;
+    }
+    return FS_OK;
+  case FLOWSIM_IO_GPIOS:
+    sim->gpios = value;
+    return FS_OK;
+  }
+  return FS_OK;
+}
+
+static int fs_type_bytes(int type)
+{
+  switch (type) {
+  case 8: return 1;   /* uint8 */
+  case 4: return 2;   /* uint16 */
+  case 2: return 4;   /* uint32 */
+  case 1: return 8;   /* uint64 */
+  }
+  return 0;
+}
+
+/***********************************************************
+ * CPU
+ **********************************************************/
+static int fs_step(flowsim_t *sim)
+{
+  unsigned char buffer[4096];
+  long at = sim->pc * 8;
+  if (at < 0 || at + 8 > sim->p.mem_size_b) {
+    fs_fail(sim, "pc out of memory: %ld", sim->pc);
+    return FLOWSIM_ERROR;
+  }
+  unsigned char *b = sim->mem + at;
+  uint32_t arg32 = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  int arg8_3 = b[4], arg8_2 = b[5], arg8_1 = b[6], opcode = b[7];
+  uint32_t *r = sim->regs;
+  int rc = FS_OK;
+  long next = sim->pc + 1;
+
+  sim->stats.cycles++;
+  switch (opcode) {
+  case FLOWSIM_OP_WRITECONFIG:
+    rc = fs_write_config(sim, arg8_1, arg32);
+    break;
+  case FLOWSIM_OP_GETSTATUS:
+    sim->stats.cycles += arg8_2;
+    rc = fs_get_status(sim, arg8_1);
+    break;
+  case FLOWSIM_OP_WRITESTREAM: {
+    /* data follows the instruction, padded to 8 bytes */
+    long n = (long)arg32 * fs_type_bytes(arg8_3);
+    if (n == 0 && arg32) { fs_fail(sim, "writeStream: invalid type %d", arg8_3); return FLOWSIM_ERROR; }
+    if (at + 8 + n > sim->p.mem_size_b) { fs_fail(sim, "writeStream: data out of memory"); return FLOWSIM_ERROR; }
+    rc = fs_io_sink(sim, arg8_1, sim->mem + at + 8, n, fs_type_bytes(arg8_3));
+    sim->stats.cycles += arg32;
+    next = sim->pc + 1 + (n + 7) / 8;
+    break;
+  }
+  case FLOWSIM_OP_ROUTESTREAM: {
+    if (!sim->route_active) {
+      sim->route_left = (long)arg32 * fs_type_bytes(arg8_3);
+      sim->route_active = 1;
+      sim->stats.cycles += arg32;
+    }
+    while (sim->route_left > 0) {
+      long n = sim->route_left < (long)sizeof(buffer) ? sim->route_left : (long)sizeof(buffer);
+      long got = fs_io_source(sim, arg8_1, buffer, n);
+      if (got < 0) return FLOWSIM_ERROR;
+      if (got > 0 && fs_io_sink(sim, arg8_2, buffer, got, fs_type_bytes(arg8_3)) != FS_OK) return FLOWSIM_ERROR;
+      if (arg8_1 == FLOWSIM_IO_ETH) sim->stats.eth_rx_b += got;
+      sim->route_left -= got;
+      if (got < n) return FLOWSIM_WAIT_RX;   /* resumed later, pc is kept */
+    }
+    sim->route_active = 0;
+    break;
+  }
+  case FLOWSIM_OP_WRITEWORD:
+    rc = fs_io_write_word(sim, arg8_1, r[arg8_2 & 15]);
+    break;
+  case FLOWSIM_OP_READWORD:
+    rc = fs_io_read_word(sim, arg8_1, &r[arg8_2 & 15]);
+    break;
+  case FLOWSIM_OP_SETREG:
+    r[arg8_2 & 15] = arg32;
+    break;
+  case FLOWSIM_OP_GOTO:
+    if (arg8_1 == 0 || (arg8_1 == 1 && r[arg8_2 & 15] != 0)
+        || (arg8_1 == 2 && r[arg8_2 & 15] == 0)) next = arg32;
+    break;
+  case FLOWSIM_OP_ADD:
+    r[arg8_3 & 15] = r[arg8_1 & 15] + r[arg8_2 & 15];
+    break;
+  case FLOWSIM_OP_AND:
+    r[arg8_3 & 15] = r[arg8_1 & 15] & r[arg8_2 & 15];
+    break;
+  case FLOWSIM_OP_OR:
+    r[arg8_3 & 15] = r[arg8_1 & 15] | r[arg8_2 & 15];
+    break;
+  case FLOWSIM_OP_COMP:
+    r[arg8_3 & 15] = (r[arg8_1 & 15] == r[arg8_2 & 15]) ? 1 : 0;
+    break;
+  case FLOWSIM_OP_SHR:
+    if (arg8_2) r[arg8_3 & 15] = (r[arg8_1 & 15] >> 1) | (r[arg8_1 & 15] & 0x80000000);
+    else r[arg8_3 & 15] = r[arg8_1 & 15] >> 1;
+    break;
+  case FLOWSIM_OP_CONTROL:
+  case FLOWSIM_OP_NOP:
+    break;
+  case FLOWSIM_OP_TERM:
+    sim->halted = 1;
+    sim->stats.instructions++;
+    return FLOWSIM_HALTED;
+  default:
+    fs_fail(sim, "unknown opcode %d at %ld", opcode, sim->pc);
+    return FLOWSIM_ERROR;
+  }
+  if (rc != FS_OK) return FLOWSIM_ERROR;
+  sim->stats.instructions++;
+  sim->pc = next;
+  return FLOWSIM_RUNNING;
+}
+
+/***********************************************************
+ * API
+ **********************************************************/
+flowsim_t *flowsim_new(const flowsim_params *params)
+{
+  int i, t = 0;
+  if (params->word_b != 2 || params->nb_ports <= params->dma_port
+      || params->grid_port_0 > params->nb_ports) return NULL;
+  flowsim_t *sim = calloc(1, sizeof(flowsim_t));
+  if (!sim) return NULL;
+  sim->p = *params;
+  sim->mem = calloc(params->mem_size_b, 1);
+  sim->ports = calloc(params->nb_ports, sizeof(fs_port));
+  sim->nb_tiles = params->nb_convs + params->nb_alus + params->nb_mappers + 1;
+  sim->tiles = calloc(sim->nb_tiles, sizeof(fs_tile));
+  if (!sim->mem || !sim->ports || !sim->tiles) {
+    flowsim_free(sim);
+    return NULL;
+  }
+  for (i = 0; i < params->nb_convs; i++, t++) {
+    sim->tiles[t].kind = FS_CONV; sim->tiles[t].column = i;
+    sim->tiles[t].addr = FLOWSIM_ADDR_CONV_0 + i;
+  }
+  for (i = 0; i < params->nb_alus; i++, t++) {
+    sim->tiles[t].kind = FS_COMB; sim->tiles[t].column = i;
+    sim->tiles[t].addr = FLOWSIM_ADDR_COMB_0 + i;
+  }
+  for (i = 0; i < params->nb_mappers; i++, t++) {
+    sim->tiles[t].kind = FS_MAPP; sim->tiles[t].column = i;
+    sim->tiles[t].addr = FLOWSIM_ADDR_MAPP_0 + i;
+  }
+  sim->tiles[t].kind = FS_COMB; sim->tiles[t].column = 0;
+  sim->tiles[t].addr = FLOWSIM_ADDR_DIV_0;
+  for (t = 0; t < sim->nb_tiles; t++) {
+    if (sim->tiles[t].addr < FLOWSIM_ADDR_GRID_0 && !sim->tile_at[sim->tiles[t].addr])
+      sim->tile_at[sim->tiles[t].addr] = &sim->tiles[t];
+  }
+  sim->first_call = 1;
+  sim->handshake = 1;
+  flowsim_reset(sim);
+  return sim;
+}
+
+void flowsim_free(flowsim_t *sim)
+{
+  if (!sim) return;
+  if (sim->tiles) {
+    int t;
+    for (t = 0; t < sim->nb_tiles; t++) fs_tile_reset(&sim->tiles[t]);
+  }
+  fs_arena_clear(sim);
+  free(sim->arena);
+  free(sim->tiles);
+  free(sim->ports);
+  free(sim->mem);
+  fs_buffer_free(&sim->uart);
+  fs_buffer_free(&sim->uart_out);
+  fs_buffer_free(&sim->rx);
+  fs_buffer_free(&sim->tx);
+  fs_buffer_free(&sim->frames);
+  free(sim);
+}
+
+int flowsim_load(flowsim_t *sim, const unsigned char *image, long size, long offset)
+{
+  if (offset < 0 || offset + size > sim->p.mem_size_b) {
+    fs_fail(sim, "image of %ld bytes does not fit at offset %ld", size, offset);
+    return -1;
+  }
+  memcpy(sim->mem + offset, image, size);
+  return 0;
+}
+
+void flowsim_reset(flowsim_t *sim)
+{
+  int i;
+  memset(sim->regs, 0, sizeof(sim->regs));
+  sim->pc = sim->p.entry_point;
+  sim->halted = 0;
+  sim->route_active = 0;
+  sim->area = sim->addr = sim->sub = 0;
+  for (i = 0; i < sim->p.nb_ports; i++) fs_port_reset(&sim->ports[i]);
+  for (i = 0; i < sim->nb_tiles; i++) fs_tile_reset(&sim->tiles[i]);
+  sim->tx_busy = 0;
+  sim->idle_polls = 0;
+  sim->error[0] = 0;
+}
+
+int flowsim_run(flowsim_t *sim, long max_instructions, int until_tx)
+{
+  long n;
+  if (sim->halted) return FLOWSIM_HALTED;
+  for (n = 0; max_instructions <= 0 || n < max_instructions; n++) {
+    if (until_tx && fs_buffer_pending(&sim->frames)) return FLOWSIM_WAIT_TX;
+    int state = fs_step(sim);
+    if (state != FLOWSIM_RUNNING) return state;
+    if (sim->idle_polls > FS_IDLE_POLLS) {
+      /* polling the Ethernet status, with nothing to receive */
+      sim->idle_polls = 0;
+      return FLOWSIM_WAIT_RX;
+    }
+  }
+  if (until_tx && fs_buffer_pending(&sim->frames)) return FLOWSIM_WAIT_TX;
+  return FLOWSIM_RUNNING;
+}
+
+const char *flowsim_error(flowsim_t *sim)
+{
+  return sim->error;
+}
+
+const flowsim_stats *flowsim_get_stats(flowsim_t *sim)
+{
+  return &sim->stats;
+}
+
+unsigned char *flowsim_memory(flowsim_t *sim, long *size)
+{
+  if (size) *size = sim->p.mem_size_b;
+  return sim->mem;
+}
+
+const char *flowsim_uart(flowsim_t *sim, long *length)
+{
+  long n = fs_buffer_pending(&sim->uart);
+  sim->uart_out.size = 0;
+  sim->uart_out.head = 0;
+  fs_buffer_append(&sim->uart_out, sim->uart.data + sim->uart.head, n);
+  fs_buffer_append(&sim->uart_out, (const unsigned char *)"", 1);
+  fs_buffer_take(&sim->uart, NULL, n);
+  if (length) *length = n;
+  return (const char *)sim->uart_out.data;
+}
+
+int flowsim_eth_push(flowsim_t *sim, const unsigned char *data, int length)
+{
+  if (fs_buffer_append(&sim->rx, data, length)) return -1;
+  sim->idle_polls = 0;
+  return 0;
+}
+
+int flowsim_eth_pop(flowsim_t *sim, unsigned char *buffer, int max_length)
+{
+  unsigned char header[4];
+  if (fs_buffer_pending(&sim->frames) < 4) return -1;
+  fs_buffer_take(&sim->frames, header, 4);
+  long length = header[0] | (header[1] << 8) | (header[2] << 16) | ((long)header[3] << 24);
+  long n = length < max_length ? length : max_length;
+  fs_buffer_take(&sim->frames, buffer, n);
+  fs_buffer_take(&sim->frames, NULL, length - n);
+  return (int)n;
+}
+
+/***********************************************************
+ * host side (see etherflow/generic/etherflow.c)
+ **********************************************************/
+int flowsim_host_receive_frame(flowsim_t *sim, unsigned char *buffer, int *length)
+{
+  int n;
+  for (;;) {
+    n = flowsim_eth_pop(sim, buffer, FS_ETH_DATA_LEN + FS_ETH_MIN_LEN);
+    if (n >= 0) break;
+    int state = flowsim_run(sim, 0, 1);
+    if (state == FLOWSIM_HALTED) {
+      fs_fail(sim, "host waits for a frame, but the device halted");
+      return -1;
+    } else if (state == FLOWSIM_WAIT_RX) {
+      fs_fail(sim, "deadlock: host waits for a frame, device waits for host data");
+      return -1;
+    } else if (state == FLOWSIM_ERROR) {
+      return -1;
+    }
+  }
+  if (length) *length = n;
+
+  /* grant a new window once the device has used it */
+  if (sim->credit_frames > 0 && ++sim->credit_count == sim->credit_frames) {
+    sim->credit_count = 0;
+    flowsim_eth_push(sim, (const unsigned char *)
+                     "CREDIT--12345678123456781234567812345678123456781234567812345678", 64);
+  }
+  return 0;
+}
+
+static int fs_host_descriptor(flowsim_t *sim)
+{
+  unsigned char frame[FS_ETH_DATA_LEN + FS_ETH_MIN_LEN];
+  int rc = 0;
+  if (!sim->first_call) rc = flowsim_host_receive_frame(sim, frame, NULL);
+  sim->first_call = 0;
+  return rc;
+}
+
+static int fs_host_send_packet(flowsim_t *sim, unsigned char *packet, int size)
+{
+  /* only the last packet could be not dividable by 4, and
+     packets are at least 64 bytes */
+  while (size % 4 != 0) packet[size++] = 0;
+  while (size < FS_ETH_MIN_LEN) packet[size++] = 0;
+  return flowsim_eth_push(sim, packet, size);
+}
+
+int flowsim_host_send_frame(flowsim_t *sim, const unsigned char *data, int length)
+{
+  return flowsim_eth_push(sim, data, length);
+}
+
+int flowsim_host_send_tensor(flowsim_t *sim, const double *data, long size)
+{
+  unsigned char packet[FS_ETH_DATA_LEN + FS_ETH_MIN_LEN];
+  double one = (double)(1 << sim->p.frac);
+  long i = 0;
+  if (fs_host_descriptor(sim)) return -1;
+  while (i < size) {
+    int n = 0;
+    for (; n < FS_ETH_DATA_LEN && i < size; n += 2, i++) {
+      double v = data[i] * one + 0.5;
+      if (v > 32767) v = 32767;
+      if (v < -32768) v = -32768;
+      int16_t fixed = (int16_t)v;
+      packet[n] = (uint16_t)fixed & 0xFF;
+      packet[n+1] = ((uint16_t)fixed >> 8) & 0xFF;
+    }
+    if (fs_host_send_packet(sim, packet, n)) return -1;
+  }
+  return 0;
+}
+
+int flowsim_host_send_bytes(flowsim_t *sim, const unsigned char *data, long size)
+{
+  unsigned char packet[FS_ETH_DATA_LEN + FS_ETH_MIN_LEN];
+  long i = 0;
+  if (fs_host_descriptor(sim)) return -1;
+  while (i < size) {
+    int n = (size - i) < FS_ETH_DATA_LEN ? (int)(size - i) : FS_ETH_DATA_LEN;
+    memcpy(packet, data + i, n);
+    i += n;
+    if (fs_host_send_packet(sim, packet, n)) return -1;
+  }
+  return 0;
+}
+
+int flowsim_host_receive_tensor(flowsim_t *sim, double *data, long size, long height)
+{
+  unsigned char frame[FS_ETH_DATA_LEN + FS_ETH_MIN_LEN];
+  double one = (double)(1 << sim->p.frac);
+  long num_of_bytes = size*2, length = 0, k = 0;
+  int i, n;
+  if (fs_host_descriptor(sim)) return -1;
+
+  /* an odd nb of words is completed by one line */
+  if (num_of_bytes % 4 != 0) num_of_bytes += (size/height)*2;
+
+  while (length < num_of_bytes) {
+    if (flowsim_host_receive_frame(sim, frame, &n)) return -1;
+    length += n;
+    for (i = 0; k < size && i + 1 < n; i += 2) {
+      data[k++] = (int16_t)(frame[i] | (frame[i+1] << 8)) / one;
+    }
+  }
+
+  /* ack after each tensor */
+  if (sim->handshake)
+    flowsim_eth_push(sim, (const unsigned char *)
+                     "1234567812345678123456781234567812345678123456781234567812345678", 64);
+  return 0;
+}
+
+void flowsim_host_handshake(flowsim_t *sim, int enable)
+{
+  sim->handshake = enable;
+}
+
+void flowsim_host_set_first_call(flowsim_t *sim, int first_call)
+{
+  sim->first_call = first_call;
+}
+
+void flowsim_host_credits(flowsim_t *sim, int frames)
+{
+  sim->credit_frames = frames;
+  sim->credit_count = 0;
+}
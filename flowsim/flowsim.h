@@ -0,0 +1,246 @@
+/***********************************************************
+ * flowsim - an instruction-level simulator of neuFlow
+ *
+ * Executes oFlower bytecode (8-byte instructions), and
+ * models the config bus, the streamer ports and the grid
+ * tiles (convolvers, mappers, ALUs) in fixed point.
+ * The Ethernet link to the host is an in-process queue.
+ *
+ * The grid is evaluated at the stream level: once every
+ * port a write port depends on is active, the whole
+ * output stream is computed and written to memory.
+ *
+ * The platform constants that differ between the
+ * defines_*.lua files are passed in flowsim_params; the
+ * encodings below must match blast_bus/oFlower.
+ **********************************************************/
+#ifndef _FLOWSIM_H_
+#define _FLOWSIM_H_
+
+#include <stdint.h>
+
+/***********************************************************
+ * oFlower opcodes
+ **********************************************************/
+#define FLOWSIM_OP_WRITECONFIG  0
+#define FLOWSIM_OP_GETSTATUS    1
+#define FLOWSIM_OP_WRITESTREAM  2
+#define FLOWSIM_OP_ROUTESTREAM  3
+#define FLOWSIM_OP_WRITEWORD    4
+#define FLOWSIM_OP_READWORD     5
+#define FLOWSIM_OP_SETREG       6
+#define FLOWSIM_OP_GOTO         7
+#define FLOWSIM_OP_ADD          8
+#define FLOWSIM_OP_CONTROL      9
+#define FLOWSIM_OP_AND          10
+#define FLOWSIM_OP_OR           11
+#define FLOWSIM_OP_COMP         12
+#define FLOWSIM_OP_SHR          13
+#define FLOWSIM_OP_NOP          14
+#define FLOWSIM_OP_TERM         15
+
+/***********************************************************
+ * oFlower I/O map
+ **********************************************************/
+#define FLOWSIM_IO_UART         0
+#define FLOWSIM_IO_UART_STATUS  1
+#define FLOWSIM_IO_DMA          2
+#define FLOWSIM_IO_DMA_STATUS   3
+#define FLOWSIM_IO_ETH          4
+#define FLOWSIM_IO_ETH_STATUS   5
+#define FLOWSIM_IO_GPIOS        10
+#define FLOWSIM_IO_TIMER        11
+#define FLOWSIM_IO_TIMER_CTRL   12
+
+/***********************************************************
+ * blast bus
+ **********************************************************/
+#define FLOWSIM_AREA_STREAMER   1
+#define FLOWSIM_AREA_TILE       2
+
+#define FLOWSIM_ADDR_BROADCAST  0
+#define FLOWSIM_ADDR_CONV_0     1
+#define FLOWSIM_ADDR_COMB_0     16
+#define FLOWSIM_ADDR_MAPP_0     24
+#define FLOWSIM_ADDR_DIV_0      28
+#define FLOWSIM_ADDR_GRID_0     256
+
+#define FLOWSIM_SUB_ROUTER      0
+#define FLOWSIM_SUB_OPERATOR    1
+#define FLOWSIM_SUB_CACHER      2
+#define FLOWSIM_SUB_IO          3
+#define FLOWSIM_SUB_TIMEOUTS    0
+#define FLOWSIM_SUB_GLOBALS     1
+#define FLOWSIM_SUB_LOCALS      2
+
+#define FLOWSIM_CONTENT_NOTHING 0
+#define FLOWSIM_CONTENT_COMMAND 1
+#define FLOWSIM_CONTENT_INSTRUC 2
+#define FLOWSIM_CONTENT_CONFIG  3
+
+#define FLOWSIM_INSTR_CONFIG       0
+#define FLOWSIM_INSTR_SETADD       1
+#define FLOWSIM_INSTR_ACTIVATE     2
+#define FLOWSIM_INSTR_DEACTIVATE   3
+#define FLOWSIM_INSTR_RESET        4
+#define FLOWSIM_INSTR_CONTROL_0    6
+#define FLOWSIM_INSTR_CONTROL_1    7
+#define FLOWSIM_INSTR_CACHESTART   14
+#define FLOWSIM_INSTR_CACHEFINISH  15
+
+#define FLOWSIM_STATUS_IDLE         1
+#define FLOWSIM_STATUS_BUSY         2
+#define FLOWSIM_STATUS_DONE         3
+#define FLOWSIM_STATUS_PRIMED       4
+#define FLOWSIM_STATUS_UNCONFIGURED 5
+
+/***********************************************************
+ * simulator states (returned by flowsim_run)
+ **********************************************************/
+#define FLOWSIM_RUNNING  0   /* instruction budget exhausted */
+#define FLOWSIM_HALTED   1   /* term instruction reached */
+#define FLOWSIM_WAIT_RX  2   /* device waits for host data */
+#define FLOWSIM_WAIT_TX  3   /* a frame is ready for the host */
+#define FLOWSIM_ERROR    4   /* see flowsim_error() */
+
+/***********************************************************
+ * platform parameters
+ **********************************************************/
+typedef struct {
+  long mem_size_b;      /* external memory (memory.size_b) */
+  int word_b;           /* streamer word (streamer.word_b) */
+  int nb_ports;         /* streamer.nb_ports */
+  int dma_port;         /* port behind io_dma (oFlower.nb_dmas-1) */
+  int grid_port_0;      /* port of global line 0 (nb_dmas+dma.nb_ios) */
+  int nb_convs;         /* grid.nb_convs */
+  int nb_alus;          /* grid.nb_alus */
+  int nb_mappers;       /* grid.nb_mappers */
+  int mapper_segs;      /* grid.mapper_segs */
+  int kernel_w;         /* grid.kernel_width */
+  int kernel_h;         /* grid.kernel_height */
+  int frac;             /* num.frac_ */
+  long entry_point;     /* first instruction executed */
+} flowsim_params;
+
+typedef struct {
+  long instructions;    /* executed instructions */
+  long cycles;          /* CPU cycles (dead cycles + transfers) */
+  long config_words;    /* words written on the config bus */
+  long grid_words;      /* words written to memory by the grid */
+  long eth_rx_b;        /* bytes received from the host */
+  long eth_tx_b;        /* bytes sent to the host */
+  long eth_frames;      /* frames sent to the host */
+} flowsim_stats;
+
+typedef struct flowsim_t flowsim_t;
+
+/***********************************************************
+ * flowsim_new()
+ * what: creates a simulator, with all memory zeroed
+ * params:
+ *    params - platform parameters
+ * returns:
+ *    sim - a simulator, or NULL
+ **********************************************************/
+flowsim_t *flowsim_new(const flowsim_params *params);
+
+/***********************************************************
+ * flowsim_free()
+ * what: releases a simulator
+ **********************************************************/
+void flowsim_free(flowsim_t *sim);
+
+/***********************************************************
+ * flowsim_load()
+ * what: copies a bytecode image into external memory
+ * params:
+ *    image  - bytecode (instructions + embedded data)
+ *    size   - nb of bytes
+ *    offset - byte address in external memory
+ * returns:
+ *    0, or -1 if the image does not fit
+ **********************************************************/
+int flowsim_load(flowsim_t *sim, const unsigned char *image, long size, long offset);
+
+/***********************************************************
+ * flowsim_reset()
+ * what: resets the CPU (pc = entry point), the ports and
+ *       the tiles. Memory and host queues are kept.
+ **********************************************************/
+void flowsim_reset(flowsim_t *sim);
+
+/***********************************************************
+ * flowsim_run()
+ * what: executes instructions
+ * params:
+ *    max_instructions - budget (<= 0: no limit)
+ *    until_tx         - stop as soon as a frame is ready
+ * returns:
+ *    state - one of FLOWSIM_RUNNING .. FLOWSIM_ERROR
+ **********************************************************/
+int flowsim_run(flowsim_t *sim, long max_instructions, int until_tx);
+
+/***********************************************************
+ * flowsim_error()
+ * what: describes the last error
+ **********************************************************/
+const char *flowsim_error(flowsim_t *sim);
+
+/***********************************************************
+ * flowsim_stats()
+ * what: returns the execution counters
+ **********************************************************/
+const flowsim_stats *flowsim_get_stats(flowsim_t *sim);
+
+/***********************************************************
+ * flowsim_memory()
+ * what: direct access to the external memory
+ * params:
+ *    size - returns the memory size, in bytes
+ **********************************************************/
+unsigned char *flowsim_memory(flowsim_t *sim, long *size);
+
+/***********************************************************
+ * flowsim_uart()
+ * what: returns (and clears) the UART output
+ * params:
+ *    length - nb of bytes returned
+ * returns:
+ *    text - valid until the next call to the simulator
+ **********************************************************/
+const char *flowsim_uart(flowsim_t *sim, long *length);
+
+/***********************************************************
+ * Ethernet queue, device side:
+ *   flowsim_eth_push() queues a frame for the device
+ *   flowsim_eth_pop() dequeues a frame sent by the device,
+ *     returns its length, or -1 if none is pending
+ **********************************************************/
+int flowsim_eth_push(flowsim_t *sim, const unsigned char *data, int length);
+int flowsim_eth_pop(flowsim_t *sim, unsigned char *buffer, int max_length);
+
+/***********************************************************
+ * Ethernet queue, host side: mirrors the etherflow API,
+ * the device is run whenever the host waits for a frame.
+ * All functions return 0, or -1 on error (deadlock, device
+ * halted, see flowsim_error()).
+ **********************************************************/
+int flowsim_host_receive_frame(flowsim_t *sim, unsigned char *buffer, int *length);
+int flowsim_host_send_frame(flowsim_t *sim, const unsigned char *data, int length);
+int flowsim_host_send_tensor(flowsim_t *sim, const double *data, long size);
+int flowsim_host_send_bytes(flowsim_t *sim, const unsigned char *data, long size);
+int flowsim_host_receive_tensor(flowsim_t *sim, double *data, long size, long height);
+void flowsim_host_handshake(flowsim_t *sim, int enable);
+void flowsim_host_set_first_call(flowsim_t *sim, int first_call);
+
+/***********************************************************
+ * flowsim_host_credits()
+ * what: credit-based flow control: the host grants a new
+ *       window (a 64-byte frame) every 'frames' frames it
+ *       receives, 0 disables it. Restarts the count.
+ *       Disable it while an image is loaded, and re-arm it
+ *       once the program runs.
+ **********************************************************/
+void flowsim_host_credits(flowsim_t *sim, int frames);
+
+#endif
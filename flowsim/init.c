@@ -0,0 +1,350 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <luaT.h>
+#include <TH/TH.h>
+
+#include "flowsim.h"
+
+#define FLOWSIM_META "flowsim.Simulator"
+
+static const void* torch_ByteTensor_id = NULL;
+static const void* torch_FloatTensor_id = NULL;
+static const void* torch_DoubleTensor_id = NULL;
+
+static const char *state_names[] = {"running", "halted", "waitrx", "waittx", "error"};
+
+/***********************************************************
+ * helpers
+ **********************************************************/
+static flowsim_t *checksim(lua_State *L)
+{
+  flowsim_t **sim = (flowsim_t **)luaL_checkudata(L, 1, FLOWSIM_META);
+  if (!*sim) luaL_error(L, "<flowsim> simulator was released");
+  return *sim;
+}
+
+static long getfield(lua_State *L, int idx, const char *name, long def)
+{
+  long value = def;
+  lua_getfield(L, idx, name);
+  if (lua_isnumber(L, -1)) value = (long)lua_tonumber(L, -1);
+  lua_pop(L, 1);
+  return value;
+}
+
+static int failure(lua_State *L, flowsim_t *sim)
+{
+  return luaL_error(L, "<flowsim> %s", flowsim_error(sim));
+}
+
+/* returns a contiguous copy of a Float/Double tensor, as doubles */
+static double *todoubles(lua_State *L, int idx, long *size, long *height)
+{
+  THDoubleTensor *dt = luaT_toudata(L, idx, torch_DoubleTensor_id);
+  THFloatTensor *ft = luaT_toudata(L, idx, torch_FloatTensor_id);
+  double *data;
+  long i;
+  if (dt) {
+    THDoubleTensor *c = THDoubleTensor_newContiguous(dt);
+    *size = THDoubleTensor_nElement(c);
+    *height = c->nDimension > 0 ? c->size[0] : 1;
+    data = malloc((*size+1)*sizeof(double));
+    memcpy(data, THDoubleTensor_data(c), *size*sizeof(double));
+    THDoubleTensor_free(c);
+  } else if (ft) {
+    THFloatTensor *c = THFloatTensor_newContiguous(ft);
+    float *src = THFloatTensor_data(c);
+    *size = THFloatTensor_nElement(c);
+    *height = c->nDimension > 0 ? c->size[0] : 1;
+    data = malloc((*size+1)*sizeof(double));
+    for (i = 0; i < *size; i++) data[i] = src[i];
+    THFloatTensor_free(c);
+  } else {
+    luaL_error(L, "<flowsim> expecting a torch.DoubleTensor or torch.FloatTensor");
+    return NULL;
+  }
+  return data;
+}
+
+/***********************************************************
+ * Lua wrappers
+ **********************************************************/
+static int flowsim_new_lua(lua_State *L)
+{
+  flowsim_params p;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  p.mem_size_b = getfield(L, 1, "mem_size_b", 0);
+  p.word_b = getfield(L, 1, "word_b", 2);
+  p.nb_ports = getfield(L, 1, "nb_ports", 0);
+  p.dma_port = getfield(L, 1, "dma_port", 1);
+  p.grid_port_0 = getfield(L, 1, "grid_port_0", 2);
+  p.nb_convs = getfield(L, 1, "nb_convs", 0);
+  p.nb_alus = getfield(L, 1, "nb_alus", 0);
+  p.nb_mappers = getfield(L, 1, "nb_mappers", 0);
+  p.mapper_segs = getfield(L, 1, "mapper_segs", 8);
+  p.kernel_w = getfield(L, 1, "kernel_w", 10);
+  p.kernel_h = getfield(L, 1, "kernel_h", 10);
+  p.frac = getfield(L, 1, "frac", 8);
+  p.entry_point = getfield(L, 1, "entry_point", 0);
+
+  flowsim_t **sim = (flowsim_t **)lua_newuserdata(L, sizeof(flowsim_t *));
+  *sim = flowsim_new(&p);
+  if (!*sim) return luaL_error(L, "<flowsim> invalid platform parameters");
+  luaL_getmetatable(L, FLOWSIM_META);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int flowsim_free_lua(lua_State *L)
+{
+  flowsim_t **sim = (flowsim_t **)luaL_checkudata(L, 1, FLOWSIM_META);
+  flowsim_free(*sim);
+  *sim = NULL;
+  return 0;
+}
+
+static int flowsim_load_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  THByteTensor *tensor = luaT_checkudata(L, 2, torch_ByteTensor_id);
+  long offset = luaL_optlong(L, 3, 0);
+  THByteTensor *c = THByteTensor_newContiguous(tensor);
+  int error = flowsim_load(sim, THByteTensor_data(c), THByteTensor_nElement(c), offset);
+  THByteTensor_free(c);
+  if (error) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_reset_lua(lua_State *L)
+{
+  flowsim_reset(checksim(L));
+  return 0;
+}
+
+static int flowsim_run_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  long max = luaL_optlong(L, 2, 0);
+  int state = flowsim_run(sim, max, lua_toboolean(L, 3));
+  lua_pushstring(L, state_names[state]);
+  if (state == FLOWSIM_ERROR) {
+    lua_pushstring(L, flowsim_error(sim));
+    return 2;
+  }
+  return 1;
+}
+
+static int flowsim_send_tensor_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  long size, height;
+  double *data = todoubles(L, 2, &size, &height);
+  int error = flowsim_host_send_tensor(sim, data, size);
+  free(data);
+  if (error) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_send_tensor_uint8_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  long size, height, i;
+  double *data = todoubles(L, 2, &size, &height);
+  unsigned char *bytes = malloc(size+1);
+  for (i = 0; i < size; i++) {
+    double v = data[i] * 256 + 0.5;
+    bytes[i] = v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+  }
+  int error = flowsim_host_send_bytes(sim, bytes, size);
+  free(bytes);
+  free(data);
+  if (error) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_send_bytetensor_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  THByteTensor *tensor = luaT_checkudata(L, 2, torch_ByteTensor_id);
+  THByteTensor *c = THByteTensor_newContiguous(tensor);
+  int error = flowsim_host_send_bytes(sim, THByteTensor_data(c), THByteTensor_nElement(c));
+  THByteTensor_free(c);
+  if (error) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_receive_tensor_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  THDoubleTensor *dt = luaT_toudata(L, 2, torch_DoubleTensor_id);
+  THFloatTensor *ft = luaT_toudata(L, 2, torch_FloatTensor_id);
+  long size, height, i;
+  double *data;
+  int error;
+  if (dt) {
+    size = THDoubleTensor_nElement(dt);
+    height = dt->nDimension > 0 ? dt->size[0] : 1;
+  } else if (ft) {
+    size = THFloatTensor_nElement(ft);
+    height = ft->nDimension > 0 ? ft->size[0] : 1;
+  } else {
+    return luaL_error(L, "<flowsim> expecting a torch.DoubleTensor or torch.FloatTensor");
+  }
+  data = malloc((size+1)*sizeof(double));
+  error = flowsim_host_receive_tensor(sim, data, size, height);
+  if (!error) {
+    if (dt) {
+      THDoubleTensor *c = THDoubleTensor_newContiguous(dt);
+      memcpy(THDoubleTensor_data(c), data, size*sizeof(double));
+      THDoubleTensor_freeCopyTo(c, dt);
+    } else {
+      THFloatTensor *c = THFloatTensor_newContiguous(ft);
+      float *dst = THFloatTensor_data(c);
+      for (i = 0; i < size; i++) dst[i] = (float)data[i];
+      THFloatTensor_freeCopyTo(c, ft);
+    }
+  }
+  free(data);
+  if (error) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_send_frame_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  size_t length;
+  const char *data = luaL_checklstring(L, 2, &length);
+  if (flowsim_host_send_frame(sim, (const unsigned char *)data, length)) return failure(L, sim);
+  return 0;
+}
+
+static int flowsim_receive_string_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  unsigned char buffer[2048];
+  int length;
+  if (flowsim_host_receive_frame(sim, buffer, &length)) return failure(L, sim);
+  buffer[length] = 0;
+  lua_pushstring(L, (char *)buffer);
+  return 1;
+}
+
+static int flowsim_receive_frame_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  unsigned char buffer[2048];
+  int length, i;
+  if (flowsim_host_receive_frame(sim, buffer, &length)) return failure(L, sim);
+  lua_pushnumber(L, length);
+  lua_newtable(L);
+  for (i = 0; i < length; i++) {
+    lua_pushnumber(L, i+1);
+    lua_pushnumber(L, buffer[i]);
+    lua_settable(L, -3);
+  }
+  return 2;
+}
+
+static int flowsim_handshake_lua(lua_State *L)
+{
+  flowsim_host_handshake(checksim(L), lua_toboolean(L, 2));
+  return 0;
+}
+
+static int flowsim_set_first_call_lua(lua_State *L)
+{
+  flowsim_host_set_first_call(checksim(L), lua_tointeger(L, 2));
+  return 0;
+}
+
+static int flowsim_credits_lua(lua_State *L)
+{
+  /* no argument: flow control off */
+  flowsim_host_credits(checksim(L), luaL_optinteger(L, 2, 0));
+  return 0;
+}
+
+static int flowsim_uart_lua(lua_State *L)
+{
+  long length;
+  const char *text = flowsim_uart(checksim(L), &length);
+  lua_pushlstring(L, text, length);
+  return 1;
+}
+
+static int flowsim_stats_lua(lua_State *L)
+{
+  const flowsim_stats *stats = flowsim_get_stats(checksim(L));
+  lua_newtable(L);
+  lua_pushnumber(L, stats->instructions); lua_setfield(L, -2, "instructions");
+  lua_pushnumber(L, stats->cycles); lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, stats->config_words); lua_setfield(L, -2, "config_words");
+  lua_pushnumber(L, stats->grid_words); lua_setfield(L, -2, "grid_words");
+  lua_pushnumber(L, stats->eth_rx_b); lua_setfield(L, -2, "eth_rx_b");
+  lua_pushnumber(L, stats->eth_tx_b); lua_setfield(L, -2, "eth_tx_b");
+  lua_pushnumber(L, stats->eth_frames); lua_setfield(L, -2, "eth_frames");
+  return 1;
+}
+
+static int flowsim_readmem_lua(lua_State *L)
+{
+  flowsim_t *sim = checksim(L);
+  long offset = luaL_checklong(L, 2);
+  THByteTensor *tensor = luaT_checkudata(L, 3, torch_ByteTensor_id);
+  long size, n = THByteTensor_nElement(tensor);
+  unsigned char *mem = flowsim_memory(sim, &size);
+  if (offset < 0 || offset + n > size) return luaL_error(L, "<flowsim> read out of memory");
+  THByteTensor *c = THByteTensor_newContiguous(tensor);
+  memcpy(THByteTensor_data(c), mem + offset, n);
+  THByteTensor_freeCopyTo(c, tensor);
+  return 0;
+}
+
+/***********************************************************
+ * register functions for Lua
+ **********************************************************/
+static const struct luaL_Reg flowsim_methods__ [] = {
+  {"load", flowsim_load_lua},
+  {"reset", flowsim_reset_lua},
+  {"run", flowsim_run_lua},
+  {"send_tensor", flowsim_send_tensor_lua},
+  {"send_tensor_uint8", flowsim_send_tensor_uint8_lua},
+  {"send_bytetensor", flowsim_send_bytetensor_lua},
+  {"receive_tensor", flowsim_receive_tensor_lua},
+  {"send_frame", flowsim_send_frame_lua},
+  {"receive_string", flowsim_receive_string_lua},
+  {"receive_frame", flowsim_receive_frame_lua},
+  {"handshake", flowsim_handshake_lua},
+  {"set_first_call", flowsim_set_first_call_lua},
+  {"credits", flowsim_credits_lua},
+  {"uart", flowsim_uart_lua},
+  {"stats", flowsim_stats_lua},
+  {"readmem", flowsim_readmem_lua},
+  {"free", flowsim_free_lua},
+  {"__gc", flowsim_free_lua},
+  {NULL, NULL}
+};
+
+static const struct luaL_Reg flowsim_functions__ [] = {
+  {"new", flowsim_new_lua},
+  {NULL, NULL}
+};
+
+DLL_EXPORT int luaopen_libflowsim(lua_State *L)
+{
+  torch_ByteTensor_id = luaT_checktypename2id(L, "torch.ByteTensor");
+  torch_FloatTensor_id = luaT_checktypename2id(L, "torch.FloatTensor");
+  torch_DoubleTensor_id = luaT_checktypename2id(L, "torch.DoubleTensor");
+
+  luaL_newmetatable(L, FLOWSIM_META);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, flowsim_methods__);
+  lua_pop(L, 1);
+
+  luaL_register(L, "flowsim", flowsim_functions__);
+  return 1;
+}
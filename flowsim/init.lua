@@ -0,0 +1,92 @@
+----------------------------------------------------------------------
+--
+-- Copyright (c) 2010,2011 Clement Farabet, Polina Akselrod
+-- 
+-- Permission is hereby granted, free of charge, to any person obtaining
+-- a copy of this software and associated documentation files (the
+-- "Software"), to deal in the Software without restriction, including
+-- without limitation the rights to use, copy, modify, merge, publish,
+-- distribute, sublicense, and/or sell copies of the Software, and to
+-- permit persons to whom the Software is furnished to do so, subject to
+-- the following conditions:
+-- 
+-- The above copyright notice and this permission notice shall be
+-- included in all copies or substantial portions of the Software.
+-- 
+-- THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+-- EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+-- MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+-- NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+-- LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+-- OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+-- WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+-- 
+----------------------------------------------------------------------
+-- description:
+--     flowsim - an instruction-level simulator of neuFlow: runs the
+--               oFlower bytecode, and the grid, in fixed point. The
+--               Ethernet link is replaced by an in-process queue.
+----------------------------------------------------------------------
+
+require 'torch'
+require 'libflowsim'
+
+-- simulator parameters, from the current platform (defines_*.lua)
+function flowsim.params(entry_point)
+   return {
+      mem_size_b = memory.size_b,
+      word_b = streamer.word_b,
+      nb_ports = streamer.nb_ports,
+      dma_port = oFlower.nb_dmas - 1,
+      grid_port_0 = oFlower.nb_dmas + dma.nb_ios,
+      nb_convs = grid.nb_convs,
+      nb_alus = grid.nb_alus,
+      nb_mappers = grid.nb_mappers,
+      mapper_segs = grid.mapper_segs,
+      kernel_w = grid.kernel_width,
+      kernel_h = grid.kernel_height,
+      frac = num.frac_,
+      entry_point = entry_point or bootloader.entry_point
+   }
+end
+
+-- a link to a simulator, with the same API as etherflow
+function flowsim.link(sim, offset_code)
+   offset_code = offset_code or bootloader.entry_point_b
+   local link = {}
+
+   function link.open() return 0 end
+   function link.close() end
+   function link.sendreset() sim:reset() return 0 end
+   function link.handshake(bool) sim:handshake(bool) end
+   function link.sendstring(str) sim:send_frame(str) end
+   function link.receivestring() return sim:receive_string() end
+   function link.receiveframe() return sim:receive_frame() end
+   function link.sendtensor(tensor) sim:send_tensor(tensor) end
+   function link.sendtensor8(tensor)
+      if torch.typename(tensor) == 'torch.ByteTensor' then
+         sim:send_bytetensor(tensor)
+      else
+         sim:send_tensor_uint8(tensor)
+      end
+   end
+   function link.receivetensor(tensor) sim:receive_tensor(tensor) end
+   function link.setfirstcall(val) sim:set_first_call(val) end
+   function link.credits(frames)
+      link.credit_frames = frames
+      sim:credits(frames)
+   end
+
+   -- the bootloader is bypassed: the image is copied to memory
+   function link.loadbytecode(bytetensor)
+      -- no grants while the program is loaded
+      sim:credits()
+      sim:load(bytetensor, offset_code)
+      sim:reset()
+      sim:set_first_call(0)
+      -- the program now runs: the next frame received is its first one
+      sim:credits(link.credit_frames or 0)
+   end
+
+   return link
+end
@@ -134,6 +134,7 @@ function Camera:initCamera(cameraID, alloc_frames)
    self:config(cameraID,'power','ON')
    self.core:setreg(reg_ctrl, self.reg_ctrl)
    self.core:iowrite(oFlower.io_gpios, reg_ctrl)
+   self.core:freeRegister(reg_ctrl)
    --self.core:sleep(1)
    self.core:message('Camera: Init done')
 end
@@ -178,6 +179,8 @@ function Camera:getLastFrame(cameraID)
    self.core:bitandi(reg_acqst, mask_status, reg_tmp)
    self.core:compi(reg_tmp, 0x00000000, reg_tmp)
    self.core:loopUntilEndIfNonZero(reg_tmp)
+   self.core:freeRegister(reg_acqst)
+   self.core:freeRegister(reg_tmp)
 
    for i = 1,#lcameraID do
       table.insert(outputs, self.frames[lcameraID[i]])
@@ -220,11 +223,14 @@ function Camera:captureOneFrame(cameraID)
    self.core:bitandi(reg_acqst, mask_status, reg_tmp)
    self.core:compi(reg_tmp, mask_status, reg_tmp)
    self.core:loopUntilEndIfNonZero(reg_tmp)
+   self.core:freeRegister(reg_acqst)
+   self.core:freeRegister(reg_tmp)
 
    -- Once the acquisition start. Disable the acquisition for the next frame
    mask_ctrl = self:config(cameraID, 'acquisition', 'OFF')
    self.core:setreg(reg_ctrl, mask_ctrl)
    self.core:iowrite(oFlower.io_gpios, reg_ctrl)
+   self.core:freeRegister(reg_ctrl)
 end
 
 function Camera:enableCameras(cameraID)
@@ -237,7 +243,7 @@ function Camera:enableCameras(cameraID)
 
    for i=1,#lcameraID do
       local image_tensor = torch.Tensor(self.size[lcameraID[i]].height, self.size[lcameraID[i]].width*self.size[lcameraID[i]].component)
-      local image_segment = self.core.mem:allocPersistentData(image_tensor, '2D')
+      local image_segment = self.core.mem:allocPersistentData(image_tensor, 'auto', 'rows')
 
       self:initCamera(lcameraID[i], image_segment)
    end
@@ -249,10 +255,10 @@ function Camera:startRBCameras() -- Start camera and send images to Running Buff
    print('<neuflow.Camera> : enable Camera: ' .. self.size['A'].width * self.size['A'].component .. 'x' .. self.size['A'].height)
 
    local image_tensor_A = torch.Tensor(self.size['A'].height, self.size['A'].width*self.size['A'].component)
-   local image_segment_A = self.core.mem:allocPersistentData(image_tensor_A, '2D')
+   local image_segment_A = self.core.mem:allocPersistentData(image_tensor_A, 'auto', 'rows')
 
    local image_tensor_B = torch.Tensor(self.size['B'].height, self.size['B'].width*self.size['B'].component)
-   local image_segment_B = self.core.mem:allocPersistentData(image_tensor_B, '2D')
+   local image_segment_B = self.core.mem:allocPersistentData(image_tensor_B, 'auto', 'rows')
 
    -- The two cameras have to be initialized in the same time if an IIC configuration occured.
    self:initCamera('B', image_segment_B)
@@ -281,6 +287,7 @@ function Camera:startRBCameras() -- Start camera and send images to Running Buff
    -- trigger acquisition
    self.core:setreg(reg_ctrl, mask_ctrl)
    self.core:iowrite(oFlower.io_gpios, reg_ctrl)
+   self.core:freeRegister(reg_ctrl)
 end
 
 function Camera:stopRBCameras() -- Stop camera sending to Running Buffer
@@ -292,6 +299,7 @@ function Camera:stopRBCameras() -- Stop camera sending to Running Buffer
    -- Once the acquisition stop. Disable the acquisition for the next frame
    self.core:setreg(reg_acqst, mask_ctrl)
    self.core:iowrite(oFlower.io_gpios, reg_acqst)
+   self.core:freeRegister(reg_acqst)
    self.core:nop(100) -- small delay
 
    -- wait for the frame to finish being sent
@@ -313,6 +321,7 @@ function Camera:copyToHostLatestFrame() -- Get the latest complete frame
    self:streamLatestFrameFromPort('B', reg_acqst, dma.ethernet_read_port_id, 'full')
    self.nf.ethernet:streamFromHost(self.nf.ethernet.ack_stream[1], 'ack_stream')
    self:streamLatestFrameFromPort('A', reg_acqst, dma.ethernet_read_port_id, 'full')
+   self.core:freeRegister(reg_acqst)
 
    return torch.Tensor(2, self.size['A'].height, self.size['A'].width)
 end
@@ -384,4 +393,5 @@ function Camera:streamLatestFrameFromPort(cameraID, reg_acqst, port_addr, port_a
    for i, goto_end in pairs(goto_ends) do
       goto_end.goto_tag = goto_end_tag
    end
+   self.core:freeRegister(reg_count)
 end
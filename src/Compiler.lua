@@ -126,9 +126,168 @@ local layer = {
       function(net_compiler, module, inputs)
          return net_compiler:Parallel(module, inputs)
       end,
+
+   ["nn.Concat"] =
+      function(net_compiler, module, inputs)
+         return net_compiler:Concat(module, inputs)
+      end,
+
+   ["nn.ConcatTable"] =
+      function(net_compiler, module, inputs)
+         return net_compiler:ConcatTable(module, inputs)
+      end,
 }
 
 
+----------------------------------------------------------------------
+-- constant folding: scalar affine modules (y = a*x + b) are folded
+-- into the weights/biases of a neighboring linear layer, or into the
+-- coefficients of a neighboring mapping, before code generation.
+-- Folds that would overflow the fixed-point range are not done.
+--
+local function scalarAffine(module)
+   local name = torch.typename(module)
+   if name == 'nn.Mult' and module.weight:nElement() == 1 then
+      return module.weight[1], 0
+   elseif name == 'nn.MulConstant' then
+      return module.constant_scalar, 0
+   elseif name == 'nn.Add' and module.bias:nElement() == 1 then
+      return 1, module.bias[1]
+   elseif name == 'nn.AddConstant' then
+      return 1, module.constant_scalar
+   end
+end
+
+local linear_modules = {
+   ['nn.SpatialConvolution'] = true,
+   ['nn.SpatialConvolutionMap'] = true,
+   ['nn.SpatialLinear'] = true,
+   ['nn.SpatialSubSampling'] = true
+}
+
+-- mappings that accept a folded input map, and the bound of their
+-- output (for the ones that accept a folded output map)
+local mapping_modules = {
+   ['nn.Tanh'] = 1,
+   ['nn.TanhAbs'] = 1,
+   ['nn.StdSigm'] = 1.71593428,
+   ['nn.Abs'] = false,
+   ['nn.Threshold'] = false
+}
+
+local function inRange(...)
+   for _,t in ipairs{...} do
+      if t:max() > num.max or t:min() < num.min then
+         return false
+      end
+   end
+   return true
+end
+
+-- module(x) becomes a*module(x) + b
+local function foldAfter(module, a, b)
+   local weight = module.weight:clone():mul(a)
+   local bias = module.bias:clone():mul(a):add(b)
+   if not inRange(weight, bias) then return false end
+   module.weight:copy(weight)
+   module.bias:copy(bias)
+   return true
+end
+
+-- module(x) becomes module(a*x + b)
+local function foldBefore(module, a, b)
+   local name = torch.typename(module)
+   local weight = module.weight:clone():mul(a)
+   local bias = module.bias:clone()
+   if name == 'nn.SpatialConvolutionMap' then
+      for k = 1,module.connTable:size(1) do
+         local o = module.connTable[k][2]
+         bias[o] = bias[o] + b*module.weight[k]:sum()
+      end
+   elseif name == 'nn.SpatialSubSampling' then
+      bias:add(b*module.kW*module.kH, module.weight)
+   else
+      for o = 1,bias:size(1) do
+         bias[o] = bias[o] + b*module.weight[o]:sum()
+      end
+   end
+   if not inRange(weight, bias) then return false end
+   module.weight:copy(weight)
+   module.bias:copy(bias)
+   return true
+end
+
+-- mapping(x) becomes mapping(a*x + b)
+local function foldPre(module, a, b)
+   module.pre = {a, b}
+   return true
+end
+
+-- mapping(x) becomes a*mapping(x) + b, if the output stays in range
+local function foldPost(module, a, b)
+   local bound = mapping_modules[torch.typename(module)]
+   local post = module.post or {1, 0}
+   post = {a*post[1], a*post[2] + b}
+   if not bound or math.abs(post[1])*bound + math.abs(post[2]) > num.max then
+      return false
+   end
+   module.post = post
+   return true
+end
+
+function Compiler:foldConstants(network)
+   if network.modules then
+      for _,module in ipairs(network.modules) do
+         self:foldConstants(module)
+      end
+   end
+   if torch.typename(network) ~= 'nn.Sequential' then
+      return network
+   end
+
+   local modules = {}
+   local pending -- trailing affine modules not folded yet, and their composition
+   for _,module in ipairs(network.modules) do
+      local name = torch.typename(module)
+      local a,b = scalarAffine(module)
+      local last = modules[#modules]
+      local last_name = last and torch.typename(last)
+      local into
+      if a and last and not pending then
+         -- fold into the previous layer
+         if (linear_modules[last_name] and foldAfter(last, a, b))
+         or (mapping_modules[last_name] and foldPost(last, a, b)) then
+            into = last_name
+         end
+      elseif pending and not a then
+         -- fold the pending maps into this layer
+         if (linear_modules[name] and foldBefore(module, pending.a, pending.b))
+         or (mapping_modules[name] ~= nil and foldPre(module, pending.a, pending.b)) then
+            for i = 1,pending.n do
+               print('<neuflow.Compiler> folded ' .. torch.typename(modules[#modules]) .. ' into ' .. name)
+               modules[#modules] = nil
+            end
+         else
+            print('<neuflow.Compiler> WARNING: could not fold scalar maps into ' .. name)
+         end
+         pending = nil
+      end
+
+      if into then
+         print('<neuflow.Compiler> folded ' .. name .. ' into ' .. into)
+      else
+         table.insert(modules, module)
+         if a then
+            pending = pending or {n = 0, a = 1, b = 0}
+            pending.n = pending.n + 1
+            pending.a, pending.b = a*pending.a, a*pending.b + b
+         end
+      end
+   end
+   network.modules = modules
+   return network
+end
+
 -- top level compiler function
 function Compiler:processNetwork(network, inputs)
    if (self.print_times == 'detailled') then
@@ -138,11 +297,45 @@ function Compiler:processNetwork(network, inputs)
    end
    local module_name = torch.typename(network)
    print('<neuflow.Compiler> processing network [type = ' .. module_name .. ']')
-   local outputs = layer[module_name](self, network, inputs)
-   self:printStats()
+   -- fold scalar affine modules into their neighbors (on a copy)
+   if self.opt_across_layers then
+      network = self:foldConstants(network:clone())
+   end
+   -- configure each layer during the previous one
+   if self.opt_across_layers then
+      self.core:beginConfigPrefetch()
+   end
+   local outputs
+   if module_name == 'nn.Sequential' then
+      outputs = layer[module_name](self, network, inputs)
+   else
+      local ops = self.ops
+      self.core.estimator:beginLayer(module_name)
+      self.core:traceEvent(module_name, 'begin')
+      outputs = layer[module_name](self, network, inputs)
+      self.core:traceEvent(module_name, 'end')
+      self.core.estimator:endLayer(self.ops - ops)
+   end
+   if self.opt_across_layers then
+      self.core:endConfigPrefetch()
+   end
+   self:printStats(outputs)
    return outputs
 end
 
+-- the maps streamed with the next output of a layer: its inputs, and the
+-- outputs already allocated (placed in other banks, see allocManagedData)
+local function streamPeers(inputs, outputs)
+   local peers = {}
+   for _,input in ipairs(inputs) do
+      table.insert(peers, input)
+   end
+   for _,output in pairs(outputs) do
+      table.insert(peers, output)
+   end
+   return peers
+end
+
 function Compiler:SpatialConvolution(conv_module, inputs, mapping)
    local outputs = {}
 
@@ -186,7 +379,7 @@ function Compiler:SpatialConvolution(conv_module, inputs, mapping)
                .. item.orig_h .. ', sub_h=' ..
                conv_module.kH .. ', out_h=' .. output_height)
       end
-      outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
+      outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
 
       -- store output
       table.insert(output_list, outputs[o])
@@ -240,27 +433,14 @@ function Compiler:SpatialConvolutionMap(conv_module, inputs, mapping)
       coefs = self:getCoefs(mapping)
    end
 
-   -- parse connex table, and identidy output reuse / one2one connex
-   -- if outputs are used more than once, then they'll be reused
-   local output_reuse = false
+   -- parse connex table, and identify one2one connex
    local one_to_one = false
    local diff = (conv_module.connTable:select(2,1)-conv_module.connTable:select(2,2)):abs():max()
    if diff == 0 then
       one_to_one = true
-   else
-      for i = 1,conv_module.connTable:size(1) do
-         local current = conv_module.connTable[i][2]
-         for j = 1,conv_module.connTable:size(1) do
-            if j ~= i and current == conv_module.connTable[j][2] then
-               output_reuse = true
-               break
-            end
-         end
-         if output_reuse then break end
-      end
    end
 
-   -- depending on output/input reuse and one2one connex:
+   -- depending on one2one connex:
    if one_to_one then
       local input_list = {}
       local kernel_list = {}
@@ -275,7 +455,7 @@ function Compiler:SpatialConvolutionMap(conv_module, inputs, mapping)
             error('<neuflow.Compiler> ERROR: inconsistent subsampling ratios in_h=' .. item.orig_h .. ', sub_h=' ..
                   conv_module.kH .. ', out_h=' .. output_height)
          end
-         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
+         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
 
          -- allocate kernel + bias
          local kernel = conv_module.weight[current_op]
@@ -297,90 +477,39 @@ function Compiler:SpatialConvolutionMap(conv_module, inputs, mapping)
       -- compute output
       self.core:convolBank(input_list, kernel_list, output_list, coefs)
 
-   elseif output_reuse then
+   else
+      -- sparse connex: group connections by input and by output, so that
+      -- an input shared by several outputs is streamed once for all of them
+      local item = inputs[1]
+      local output_width = math.floor( (item.orig_w - conv_module.kW)/conv_module.dW + 1 )
+      local output_height = (item.orig_h - conv_module.kH)/conv_module.dH + 1
+      if output_height ~= math.floor(output_height) then
+         error('<neuflow.Compiler> ERROR: inconsistent subsampling ratios in_h=' .. item.orig_h .. ', sub_h=' ..
+               conv_module.kH .. ', out_h=' .. output_height)
+      end
       for o = 1,conv_module.nOutputPlane do
-         -- allocate output
-         local item = inputs[1]
-         local output_width = math.floor( (item.orig_w - conv_module.kW)/conv_module.dW + 1 )
-         local output_height = (item.orig_h - conv_module.kH)/conv_module.dH + 1
-         if output_height ~= math.floor(output_height) then
-            error('<neuflow.Compiler> ERROR: inconsistent subsampling ratios in_h=' .. item.orig_h .. ', sub_h=' ..
-                  conv_module.kH .. ', out_h=' .. output_height)
-         end
-         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
-
-         local input_list = {}
-         local kernel_list = {}
-         local output_list = {outputs[o]}
-
-         -- find all inputs
-         for i = 1,conv_module.connTable:size(1) do
-            if (o == conv_module.connTable[i][2]) then
-               -- get input from table
-               local input_p = conv_module.connTable[i][1]
-
-               -- allocate kernel + bias
-               local kernel = conv_module.weight[current_op]
-               local bias = conv_module.bias:narrow(1,o,1)
-               local kernel_mem = self.core.mem:allocEmbeddedData(kernel, bias)
-
-               -- collect connections
-               table.insert(input_list, inputs[input_p])
-               table.insert(kernel_list, kernel_mem)
-
-               -- for info, update the number of ops
-               self.ops = self.ops + output_width*output_height*conv_module.kW*conv_module.kH*2
-
-               -- next connex
-               current_op = current_op + 1
-            end
-         end
-
-         -- compute output
-         self.core:convolBank(input_list, kernel_list, output_list, coefs)
+         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
       end
 
-   else -- input reuse
-      for i = 1,conv_module.nInputPlane do
-         -- lists of outputs/kernels
-         local input_list = {inputs[i]}
-         local kernel_list = {}
-         local output_list = {}
-
-         -- find all outputs
-         for oidx = 1,conv_module.connTable:size(1) do
-            local o = conv_module.connTable[oidx][2]
-            if (i == conv_module.connTable[o][1]) then
-               -- allocate output
-               local item = inputs[1]
-               local output_width = math.floor( (item.orig_w - conv_module.kW)/conv_module.dW + 1 )
-               local output_height = (item.orig_h - conv_module.kH)/conv_module.dH + 1
-               if output_height ~= math.floor(output_height) then
-                  error('<neuflow.Compiler> ERROR: inconsistent subsampling ratios in_h=' .. item.orig_h .. ', sub_h=' ..
-                        conv_module.kH .. ', out_h=' .. output_height)
-               end
-               outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
-
-               -- allocate kernel + bias
-               local kernel = conv_module.weight[o]
-               local bias = conv_module.bias:narrow(1,o,1)
-               local kernel_mem = self.core.mem:allocEmbeddedData(kernel, bias)
+      local connections = {}
+      for k = 1,conv_module.connTable:size(1) do
+         local input_p = conv_module.connTable[k][1]
+         local o = conv_module.connTable[k][2]
 
-               -- collect connections
-               table.insert(output_list, outputs[o])
-               table.insert(kernel_list, kernel_mem)
-
-               -- for info, update the number of ops
-               self.ops = self.ops + output_width*output_height*conv_module.kW*conv_module.kH*2
+         -- allocate kernel + bias
+         local kernel = conv_module.weight[k]
+         local bias = conv_module.bias:narrow(1,o,1)
+         local kernel_mem = self.core.mem:allocEmbeddedData(kernel, bias)
 
-               -- next connex
-               current_op = current_op + 1
-            end
-         end
+         -- collect connections
+         table.insert(connections, {input = input_p, output = o, kernel = kernel_mem})
 
-         -- compute all outputs for given input
-         self.core:convolBank(input_list, kernel_list, output_list, coefs)
+         -- for info, update the number of ops
+         self.ops = self.ops + output_width*output_height*conv_module.kW*conv_module.kH*2
       end
+
+      -- compute all outputs
+      self.core:convolSparseBank(inputs, connections, outputs, coefs)
    end
 
    -- timing info
@@ -438,7 +567,7 @@ function Compiler:SpatialSubSampling(sub_module, inputs, mapping)
             newinput.w = newinput.orig_w * newinput.orig_h
             input = newinput
          end
-         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
+         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
 
          -- allocate kernel + bias
          local kernel = torch.Tensor(sub_module.kW, sub_module.kH):fill(sub_module.weight[o])
@@ -515,7 +644,7 @@ function Compiler:SpatialLPPooling(sub_module, inputs, mapping)
             newinput.w = newinput.orig_w * newinput.orig_h
             input = newinput
          end
-         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
+         outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
 
          -- allocate kernel + bias
          local kernel = sub_module.modules[2].weight[o]
@@ -561,31 +690,21 @@ function Compiler:SpatialNormalization(sub_module, inputs)
    local kernel_mean = self.core.mem:allocEmbeddedData(kernel)
    local kernel_std = self.core.mem:allocEmbeddedData(kernel)
 
-   -- alloc one intermediate map (to hold zero-mean feature map)
-   local zerom_w = inputs[1].orig_w
-   local zerom_h = inputs[1].orig_h
-   local zeros = {}
-   for i = 1,sub_module.nfeatures do
-      zeros[i] = self.core.mem:allocManagedData(torch.Tensor(zerom_h, zerom_w))
-   end
-
    -- alloc all output maps
    local outputs = {}
    local output_w = inputs[1].orig_w
    local output_h = inputs[1].orig_h
    for i = 1,sub_module.nfeatures do
-      outputs[i] = self.core.mem:allocManagedData(torch.Tensor(output_h, output_w))
+      outputs[i] = self.core.mem:allocManagedData(torch.Tensor(output_h, output_w), 'auto', 'stream', streamPeers(inputs, outputs))
    end
 
    -- collect inputs/outputs/kernels
    local input_maps = {}
-   local zero_maps = {}
    local output_maps = {}
    local mean_kernels = {}
    local std_kernels = {}
    for i = 1,sub_module.nfeatures do
       table.insert(input_maps, inputs[i])
-      table.insert(zero_maps, zeros[i])
       table.insert(output_maps, outputs[i])
       table.insert(mean_kernels, kernel_mean)
       table.insert(std_kernels, kernel_std)
@@ -644,15 +763,18 @@ function Compiler:SpatialNormalization(sub_module, inputs)
 
    end
 
-   -- local norm mean
-   self.core:localNormalizeMeanBank(input_maps, mean_kernels, zero_maps, xN_coefs)
-
-   -- local norm std
-   self.core:localNormalizeStdBank(zero_maps, std_kernels, output_maps, sqrtCoefs)
+   -- local norm mean + std, without zero-mean maps in memory
+   if sub_module.nfeatures == 1 then
+      -- all on the grid: the input is read twice
+      self.core:localNormalizeFused(input_maps[1], kernel_mean, kernel_std, output_maps[1], sqrtCoefs)
+   else
+      -- mean and std are shared by all the features
+      self.core:localNormalizeSharedBank(input_maps, std_kernels, output_maps, xN_coefs, sqrtCoefs)
+   end
 
    -- for info, update the number of ops
    self.ops = self.ops + (output_w*output_h*kernel_w*kernel_h*2
-                          + zerom_w*zerom_h*(kernel_w*kernel_h*2 + 16)) * sub_module.nfeatures
+                          + output_w*output_h*(kernel_w*kernel_h*2 + 16)) * sub_module.nfeatures
 
    -- timing info
    if (self.msg_level == 'timing') then
@@ -685,7 +807,7 @@ function Compiler:SpatialSubtractiveNormalization(sub_module, inputs)
    local output_h = inputs[1].orig_h
    local outputs = {}
    for i = 1,sub_module.nInputPlane do
-      outputs[i] = self.core.mem:allocManagedData(torch.Tensor(output_h, output_w))
+      outputs[i] = self.core.mem:allocManagedData(torch.Tensor(output_h, output_w), 'auto', 'stream', streamPeers(inputs, outputs))
    end
 
    -- collect inputs/outputs/kernels
@@ -716,7 +838,12 @@ function Compiler:SpatialSubtractiveNormalization(sub_module, inputs)
    }
 
    -- local norm mean
-   self.core:localNormalizeMeanBank(input_maps, mean_kernels, output_maps, xN_coefs)
+   if sub_module.nInputPlane == 1 then
+      -- a single convolution, with a zero-mean kernel
+      self.core:localNormalizeMean(input_maps[1], kernel_mean, output_maps[1])
+   else
+      self.core:localNormalizeMeanBank(input_maps, mean_kernels, output_maps, xN_coefs)
+   end
 
    -- for info, update the number of ops
    self.ops = self.ops + (output_w*output_h*kernel_w*kernel_h*2) * sub_module.nInputPlane
@@ -736,13 +863,278 @@ function Compiler:Parallel(par_module, inputs)
       self.core:message(string.format('PA'))
    end
 
+   -- only the feature dimension can be split/joined
+   if par_module.inputDimension ~= 1 or par_module.outputDimension ~= 1 then
+      xlua.error('Parallel only supports inputDimension = outputDimension = 1', 'neuflow.Compiler')
+   end
+   if #par_module.modules > #inputs then
+      xlua.error('Parallel has more branches than input maps', 'neuflow.Compiler')
+   end
+
+   -- each branch processes one input map
+   local branch_inputs = {}
+   for b = 1,#par_module.modules do
+      branch_inputs[b] = {inputs[b]}
+   end
+
+   return self:Branches(par_module.modules, branch_inputs)
+end
+
+function Compiler:Concat(concat_module, inputs)
+   -- verbose
+   if (self.msg_level ~= 'none') then
+      self.core:message(string.format('CAT'))
+   end
+
+   -- only the feature dimension can be joined
+   if concat_module.dimension and concat_module.dimension ~= 1 then
+      xlua.error('Concat only supports dimension = 1', 'neuflow.Compiler')
+   end
+
+   -- all branches process all the input maps
+   local branch_inputs = {}
+   for b = 1,#concat_module.modules do
+      branch_inputs[b] = inputs
+   end
+
+   return self:Branches(concat_module.modules, branch_inputs)
+end
+
+function Compiler:ConcatTable(concat_module, inputs)
+   -- verbose
+   if (self.msg_level ~= 'none') then
+      self.core:message(string.format('CT'))
+   end
+
+   -- all branches process all the input maps, the output maps of all the
+   -- branches are returned in order
+   local branch_inputs = {}
+   for b = 1,#concat_module.modules do
+      branch_inputs[b] = inputs
+   end
+
+   return self:Branches(concat_module.modules, branch_inputs)
+end
+
+-- returns the layers of a branch, as a list
+local function branchLayers(module)
+   if torch.typename(module) == 'nn.Sequential' then
+      return module.modules
+   end
+   return {module}
+end
+
+-- true if a layer is a convolution that can be merged with others
+local function isConvolution(module)
+   local typename = torch.typename(module)
+   return typename == 'nn.SpatialConvolution' or typename == 'nn.SpatialConvolutionMap'
+end
+
+-- the connections of a convolution, as a list of {input, output, weight}
+local function connections(conv_module)
+   local list = {}
+   if torch.typename(conv_module) == 'nn.SpatialConvolution' then
+      for o = 1,conv_module.nOutputPlane do
+         for i = 1,conv_module.nInputPlane do
+            table.insert(list, {i, o, conv_module.weight[o][i]})
+         end
+      end
+   else
+      for k = 1,conv_module.connTable:size(1) do
+         table.insert(list, {conv_module.connTable[k][1], conv_module.connTable[k][2],
+                             conv_module.weight[k]})
+      end
+   end
+   return list
+end
+
+--[[ Compile convolutions of the same geometry as a single bank
+
+   The convolutions (one per branch) are merged into one connection table,
+   and compiled at once: their kernels are distributed on the grid's
+   convolvers (and streamer ports), and run concurrently.
+   Returns the output maps of each convolution.
+--]]
+function Compiler:MergedConvolutions(convs, conv_inputs)
+   io.write(sys.COLORS.cyan)
+   io.write('<neuflow.Compiler> merging '..#convs..' convolutions of independent branches')
+   print(sys.COLORS.none)
+
+   -- input maps, shared by branches when possible
+   local merged_inputs = {}
+   local input_index = {}
+   local function indexOf(map)
+      if not input_index[map] then
+         table.insert(merged_inputs, map)
+         input_index[map] = #merged_inputs
+      end
+      return input_index[map]
+   end
+
+   -- connections, sorted by output
+   local conns = {}
+   local nb_outputs = 0
+   local conv_outputs = {}
+   local bias = {}
+   for c,conv in ipairs(convs) do
+      for _,conn in ipairs(connections(conv)) do
+         table.insert(conns, {indexOf(conv_inputs[c][conn[1]]), nb_outputs + conn[2], conn[3]})
+      end
+      conv_outputs[c] = {first = nb_outputs + 1, last = nb_outputs + conv.nOutputPlane}
+      for o = 1,conv.nOutputPlane do
+         bias[nb_outputs + o] = conv.bias[o]
+      end
+      nb_outputs = nb_outputs + conv.nOutputPlane
+   end
+   table.sort(conns, function(a, b)
+                        return a[2] < b[2] or (a[2] == b[2] and a[1] < b[1])
+                     end)
+
+   -- the merged convolution
+   local merged = {
+      kW = convs[1].kW, kH = convs[1].kH,
+      dW = convs[1].dW, dH = convs[1].dH,
+      nInputPlane = #merged_inputs,
+      nOutputPlane = nb_outputs,
+      connTable = torch.Tensor(#conns, 2),
+      weight = torch.Tensor(#conns, convs[1].kH, convs[1].kW),
+      bias = torch.Tensor(nb_outputs)
+   }
+   for k,conn in ipairs(conns) do
+      merged.connTable[k][1] = conn[1]
+      merged.connTable[k][2] = conn[2]
+      merged.weight[k]:copy(conn[3])
+   end
+   for o = 1,nb_outputs do
+      merged.bias[o] = bias[o]
+   end
+   local merged_outputs = self:SpatialConvolutionMap(merged, merged_inputs)
+
+   -- split the output maps back per convolution
+   local outputs = {}
+   for c = 1,#convs do
+      outputs[c] = {}
+      for o = conv_outputs[c].first,conv_outputs[c].last do
+         table.insert(outputs[c], merged_outputs[o])
+      end
+   end
+   return outputs
+end
+
+--[[ Compile independent branches
+
+   This is only a partial scheduling of the branches on disjoint hardware:
+   the branches are walked layer by layer, and at each depth where several
+   branches reach a convolution of the same geometry (kW, kH, dW, dH), these
+   convolutions are merged into a single bank (see MergedConvolutions), and
+   run concurrently.
+
+   Everything else is still compiled one branch after the other: the layers
+   between two convolutions (non-linearities, subsampling, normalizations,
+   nested containers...), and the convolutions whose geometry is not shared
+   by any other branch at the same depth. Those single convolutions are
+   compiled with the layers that follow them, so that they keep their
+   merged mappings (e.g. SpatialConvolution + Tanh).
+--]]
+function Compiler:Branches(modules, branch_inputs)
    -- timing info
    if (self.msg_level == 'timing') then
       self.core:resetTime()
    end
 
-   -- not done yet
-   xlua.error('Parallel not implemented yet', 'neuflow.Compiler')
+   -- state of each branch: its layers, the next one to compile, its maps
+   local layers = {}
+   local pos = {}
+   local maps = {}
+   for b,module in ipairs(modules) do
+      layers[b] = branchLayers(module)
+      pos[b] = 1
+      maps[b] = branch_inputs[b]
+   end
+
+   -- compiles the layers of a branch from its position up to (and not
+   -- including) the next convolution, skipping the first 'skip' layers
+   local function compileRun(b, skip)
+      local run = {}
+      local i = pos[b] + skip
+      while i <= #layers[b] and not isConvolution(layers[b][i]) do
+         i = i + 1
+      end
+      for k = pos[b],i-1 do
+         table.insert(run, layers[b][k])
+      end
+      pos[b] = i
+      if #run > 0 then
+         local run_outputs = self:Sequential({modules = run}, maps[b])
+         if maps[b] ~= branch_inputs[b] then
+            self:freeDeadMaps(maps[b], run_outputs)
+         end
+         maps[b] = run_outputs
+      end
+   end
+
+   while true do
+      -- bring every branch to its next convolution
+      for b = 1,#modules do
+         compileRun(b, 0)
+      end
+
+      -- group the branches by convolution geometry
+      local groups = {}
+      for b = 1,#modules do
+         if pos[b] <= #layers[b] then
+            local conv = layers[b][pos[b]]
+            local group
+            for _,g in ipairs(groups) do
+               local first = layers[g[1]][pos[g[1]]]
+               if conv.kW == first.kW and conv.kH == first.kH
+                  and conv.dW == first.dW and conv.dH == first.dH then
+                  group = g
+                  break
+               end
+            end
+            if group then
+               table.insert(group, b)
+            else
+               table.insert(groups, {b})
+            end
+         end
+      end
+      if #groups == 0 then
+         break
+      end
+
+      for _,group in ipairs(groups) do
+         if #group > 1 then
+            -- run the convolutions of the group concurrently
+            local convs = {}
+            local conv_inputs = {}
+            for k,b in ipairs(group) do
+               convs[k] = layers[b][pos[b]]
+               conv_inputs[k] = maps[b]
+            end
+            local conv_outputs = self:MergedConvolutions(convs, conv_inputs)
+            for k,b in ipairs(group) do
+               if maps[b] ~= branch_inputs[b] then
+                  self:freeDeadMaps(maps[b], conv_outputs[k])
+               end
+               maps[b] = conv_outputs[k]
+               pos[b] = pos[b] + 1
+            end
+         else
+            -- a single convolution, compiled with the layers that follow it
+            compileRun(group[1], 1)
+         end
+      end
+   end
+
+   -- output maps of all the branches, in order
+   local outputs = {}
+   for b = 1,#modules do
+      for _,map in ipairs(maps[b]) do
+         table.insert(outputs, map)
+      end
+   end
 
    -- timing info
    if (self.msg_level == 'timing') then
@@ -762,6 +1154,7 @@ function Compiler:Sequential(network, inputs)
    -- process Sequential
    local doneAdvance = 0
    local outputs
+   local seq_inputs = inputs
    for i=1,#network.modules do
       if doneAdvance > 0 then
          doneAdvance = doneAdvance - 1
@@ -784,8 +1177,13 @@ function Compiler:Sequential(network, inputs)
          io.write(sys.COLORS.cyan)
          io.write('<neuflow.Compiler> processing layer of type > '..module_0)
          mapping = nil
+         -- mappings with folded affine maps (see foldConstants) can't be merged with Abs
+         local function folded(k)
+            local module = network.modules[i+k]
+            return module and (module.pre or module.post)
+         end
          if self.opt_across_layers then
-            if module_0 == 'nn.Tanh' and module_1 == 'nn.Abs' then
+            if module_0 == 'nn.Tanh' and module_1 == 'nn.Abs' and not folded(0) then
                module_name = 'nn.TanhAbs'
                io.write(' merged with next layer > '..module_1..' >>> '..module_name)
                doneAdvance = 1
@@ -795,7 +1193,7 @@ function Compiler:Sequential(network, inputs)
                         ' >>> '..module_name)
                doneAdvance = 2
             elseif module_0 == 'nn.SpatialConvolution'
-               and module_1 == 'nn.Tanh' and module_2 == 'nn.Abs' then
+               and module_1 == 'nn.Tanh' and module_2 == 'nn.Abs' and not folded(1) then
                mapping = 'TanhAbs'
                io.write(' merged with next layers > '..module_1..' & '..module_2..
                         ' >>> '..module_name)
@@ -808,6 +1206,10 @@ function Compiler:Sequential(network, inputs)
                mapping = 'HardTanh'
                io.write(' merged with next layers > '..module_1..' >>> '..module_name)
                doneAdvance = 1
+            elseif module_0 == 'nn.SpatialLinear' and module_1 == 'nn.Tanh' then
+               mapping = 'Tanh'
+               io.write(' merged with next layers > '..module_1..' >>> '..module_name)
+               doneAdvance = 1
             elseif module_0 == 'nn.SpatialSubSampling' and module_1 == 'nn.Tanh' then
                mapping = 'Tanh'
                io.write(' merged with next layers > '..module_1..' >>> '..module_name)
@@ -819,7 +1221,7 @@ function Compiler:Sequential(network, inputs)
                         ..' >>> '..module_name)
                doneAdvance = 3
             elseif module_0 == 'nn.SpatialConvolutionMap'
-               and module_1 == 'nn.Tanh' and module_2 == 'nn.Abs' then
+               and module_1 == 'nn.Tanh' and module_2 == 'nn.Abs' and not folded(1) then
                mapping = 'TanhAbs'
                io.write(' merged with next layers > '..module_1..' & '..module_2
                         ..' >>> '..module_name)
@@ -840,13 +1242,27 @@ function Compiler:Sequential(network, inputs)
                doneAdvance = 3
             end
          end
+         -- a merged mapping carries its folded affine maps
+         if mapping and doneAdvance == 1 and folded(1) then
+            mapping = {type = mapping, pre = network.modules[i+1].pre, post = network.modules[i+1].post}
+         end
          print(sys.COLORS.none)
+         local ops = self.ops
+         self.core.estimator:beginLayer(module_name)
+         self.core:traceEvent(i .. ':' .. module_name, 'begin')
          if layer[module_name] then
             outputs = layer[module_name](self, network.modules[i], inputs, mapping)
          else
             xlua.error(message.ERROR_IMPLEMENTED .. module_name)
             outputs = inputs
          end
+         self.core:traceEvent(i .. ':' .. module_name, 'end')
+         self.core.estimator:endLayer(self.ops - ops)
+         -- liveness: maps produced by the previous layer are dead once
+         -- consumed, unless they belong to the caller
+         if inputs ~= seq_inputs then
+            self:freeDeadMaps(inputs, outputs)
+         end
          inputs = outputs
          if (self.msg_level == 'detailled') then
             self.core:getTime()
@@ -859,60 +1275,80 @@ function Compiler:Sequential(network, inputs)
    return outputs
 end
 
-function Compiler:SpatialLinear(linear_module, inputs)
+-- releases the managed maps in 'maps' that are not in 'live'
+function Compiler:freeDeadMaps(maps, live)
+   local keep = {}
+   for _,map in ipairs(live) do
+      keep[map] = true
+   end
+   local dead = {}
+   for _,map in ipairs(maps) do
+      if not keep[map] then
+         table.insert(dead, map)
+      end
+   end
+   self.core.mem:freeManagedData(dead)
+end
+
+function Compiler:SpatialLinear(linear_module, inputs, mapping)
    local outputs = {}
 
    if (self.msg_level ~= 'none') then
-      self.core:message(string.format('SL'))
+      if mapping then
+         self.core:message(string.format('SL+M'))
+      else
+         self.core:message(string.format('SL'))
+      end
    end
 
+   local coefs
+   if mapping then
+      -- generate coefs for this non-linear mapping
+      coefs = self:getCoefs(mapping)
+   end
+
+   -- 1x1 kernels, the bias is only loaded with the first input
+   local kernels = {}
+   local item = inputs[1]
+   local output_width = item.orig_w
+   local output_height = item.orig_h
    for o = 1,linear_module.fanout do
       -- allocate output
-      local item = inputs[1]
-      local output_width = item.orig_w
-      local output_height = item.orig_h
-      outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width))
+      outputs[o] = self.core.mem:allocManagedData(torch.Tensor(output_height, output_width), 'auto', 'stream', streamPeers(inputs, outputs))
 
+      kernels[o] = {}
       for i = 1,linear_module.fanin do
-         -- allocate kernel
          local kernel = torch.Tensor(1, 1):fill(linear_module.weight[o][i])
-         local bias = linear_module.bias:narrow(1,o,1)
-         local kernel_mem = self.core.mem:allocEmbeddedData(kernel, bias)
-
-         -- for info, update the number of ops
-         self.ops = self.ops + output_width*output_height*3
-
-         -- generate code for convolution
-         if (i == 1) then
-            self.core:convolve(inputs[i],
-                               kernel_mem,
-                               outputs[o],
-                               {bias = 'on'})
-         else
-            self.core:convolveAndAcc(inputs[i],
-                                     kernel_mem,
-                                     outputs[o],
-                                     outputs[o])
-            -- nb of ops
-            self.ops = self.ops + output_width*output_height
+         local bias
+         if i == 1 then
+            bias = linear_module.bias:narrow(1,o,1)
          end
+         kernels[o][i] = self.core.mem:allocEmbeddedData(kernel, bias)
 
-         -- optional time
-         if (self.msg_level == 'detailled') then
-            self.core:messagebody('.')
-         end
+         -- for info, update the number of ops
+         self.ops = self.ops + output_width*output_height*2
       end
    end
+
+   -- compute whole linear bank, on chains of conv tiles
+   self.core:linearBank(inputs, kernels, outputs, coefs)
+
    return outputs
 end
 
 function Compiler:getCoefs(mapping,params)
+   -- folded mappings carry their affine maps (see foldConstants)
+   if type(mapping) == 'table' then
+      params = mapping
+      mapping = mapping.type
+   end
    local type = mapping
 
    -- generate coefs for this non-linear mapping
    local coefs
+   local args
    if type == 'Tanh' then
-      coefs = math.approx {
+      args = {
          mapping     = math.tanh,
          min         = -5,
          max         = 5,
@@ -930,7 +1366,7 @@ function Compiler:getCoefs(mapping,params)
          if x < threshold then return val
          else return x end
       end
-      coefs = math.approx {
+      args = {
          mapping     = mapping,
          min         = num.min,
          max         = num.max,
@@ -942,7 +1378,7 @@ function Compiler:getCoefs(mapping,params)
          name        = type .. '-' .. threshold .. '-' .. val
       }
    elseif type == 'Abs' then
-      coefs=math.approx {
+      args = {
          mapping     = math.abs,
          min         = num.min,
          max         = num.max,
@@ -955,7 +1391,7 @@ function Compiler:getCoefs(mapping,params)
       }
    elseif type == 'TanhAbs' then
       function tanhabs (x) return math.abs(math.tanh(x)) end
-      coefs=math.approx {
+      args = {
          mapping     = tanhabs,
          min         = -5,
          max         = 5,
@@ -969,7 +1405,7 @@ function Compiler:getCoefs(mapping,params)
       }
    elseif type == 'StdSigm' then
       function stdsigm (x) return 1.71593428 * math.tanh(0.66666666*x) end
-      coefs=math.approx {
+      args = {
          mapping     = stdsigm,
          min         = num.min,
          max         = num.max,
@@ -983,7 +1419,7 @@ function Compiler:getCoefs(mapping,params)
       }--type}
    elseif type == 'StdSigmAbs' then
       function stdsigm (x) return 1.71593428 * math.tanh(0.66666666*x) end
-      coefs=math.approx {
+      args = {
          mapping     = stdsigm,
          min         = -5.5,
          max         = 5.5,
@@ -996,7 +1432,7 @@ function Compiler:getCoefs(mapping,params)
          name        = type
       }
    elseif type == 'Sqrt' then
-      coefs=math.approx {
+      args = {
          mapping     = math.sqrt,
          min         = 0,
          max         = num.max,
@@ -1013,6 +1449,26 @@ function Compiler:getCoefs(mapping,params)
       error('<neuflow.Compiler> ERROR: unknown mapping')
    end
 
+   if args then
+      -- affine maps folded around the mapping: post(f(pre(x)))
+      if params and (params.pre or params.post) then
+         local f = args.mapping
+         local pre = params.pre or {1, 0}
+         local post = params.post or {1, 0}
+         args.mapping = function(x) return post[1]*f(pre[1]*x + pre[2]) + post[2] end
+         -- input range, through the pre affine map
+         local lo = (args.min - pre[2]) / pre[1]
+         local hi = (args.max - pre[2]) / pre[1]
+         args.min = math.max(num.min, math.min(lo, hi))
+         args.max = math.min(num.max, math.max(lo, hi))
+         args.odd = args.odd and pre[2] == 0 and post[2] == 0
+         args.even = args.even and pre[2] == 0
+         args.name = string.format('%s_pre_%g_%g_post_%g_%g', args.name,
+                                   pre[1], pre[2], post[1], post[2])
+      end
+      coefs = math.approx(args)
+   end
+
    return coefs
 end
 
@@ -1105,8 +1561,12 @@ function Compiler:Reshape(reshape_module, inputs)
    return outputs
 end
 
-function Compiler:printStats()
+function Compiler:printStats(outputs)
    str = string.format('network computed requires %f MOPs', self.ops/1000000.)
    print('<neuflow.Compiler> '..str)
+   -- per layer estimate, and predicted fps
+   self.core.estimator:report(outputs)
+   print(string.format('<neuflow.Compiler> CPU registers: %d used at peak, out of %d',
+                       self.core:registerPeakUsage()))
    return str
 end
@@ -42,16 +42,30 @@ function Core:__init(args)
    memory.size_r = memory.size_b / streamer.stride_b
    oFlower.cache_size_b = args.cache_size or oFlower.cache_size_b
 
+   -- nb of conv tiles used by one pass of a bank (a compile option)
+   self.conv_group = math.min(args.conv_group or grid.nb_convs, grid.nb_convs)
+
+   -- most CPU registers live at once, for this Core (see registerPeakUsage)
+   self.register_peak = 0
+
    -- linker
    self.linker = neuflow.Linker {
       init_offset =  self.offset_code,
-      disassemble =  self.disassemble
+      disassemble =  self.disassemble,
+      peephole = args.peephole,
+      cache_config = args.cache_config
    }
 
    -- memory manager
    self.mem = neuflow.Memory {
       prog_name = args.prog_name,
       init_offset =  self.offset_code,
+      packing = args.packing
+   }
+
+   -- static performance model
+   self.estimator = neuflow.Estimator {
+      core = self
    }
 
    -- loop data structure
@@ -60,6 +74,9 @@ function Core:__init(args)
    -- convolver state
    self.nb_kernels_loaded = {} for i=1,grid.nb_convs do self.nb_kernels_loaded[i] = 0 end
 
+   -- nesting of time sensitive sections
+   self.sensitive_depth = 0
+
    -- load all methods from CoreUser
    for k,method in pairs(neuflow.CoreUser) do
       self[k] = method
@@ -120,10 +137,12 @@ end
 function Core:executionTimeSensitive(code)
    -- start sentinel
    self.linker:appendSentinel('start')
+   self.sensitive_depth = self.sensitive_depth + 1
 
    code()
 
    -- end sentinel
+   self.sensitive_depth = self.sensitive_depth - 1
    self.linker:appendSentinel('end')
 end
 
@@ -155,14 +174,19 @@ function Core:loopRepeat(times, code, ...)
 
       -- end loop
       local breaks = self.ladmin:getBreaks()
-      local loop = self.ladmin:pop()
+      local loop = self.ladmin:peek()
       if times > 0 then
          self:addi(loop.reg, -1, loop.reg)
          self:gotoTagIfNonZero(loop.tag, loop.reg)
       else
          self:gotoTag(loop.tag)
       end
+      self.ladmin:pop()
       self:loopBreakResolve(breaks)
+      self:releaseLoopRegisters(loop)
+      if loop.reg then
+         self:freeRegister(loop.reg)
+      end
    end
 end
 
@@ -186,7 +210,7 @@ end
 function Core:loopUntilStart()
    local loop = {}
    loop.tag = self:makeGotoTag()
-   self:nop()
+   self:addInstruction{opcode = oFlower.op_nop, landing = true}
 
    self.ladmin:push(loop)
 end
@@ -198,6 +222,7 @@ function Core:loopUntilEndIfNonZero(reg)
    self:gotoTagIfNonZero(loop.tag, reg)
 
    self:loopBreakResolve(breaks)
+   self:releaseLoopRegisters(loop)
 end
 
 function Core:loopUntilEndIfZero(reg)
@@ -207,6 +232,7 @@ function Core:loopUntilEndIfZero(reg)
    self:gotoTagIfZero(loop.tag, reg)
 
    self:loopBreakResolve(breaks)
+   self:releaseLoopRegisters(loop)
 end
 
 function Core:loopBreakIfNonZero(reg)
@@ -221,7 +247,8 @@ end
 
 function Core:loopBreakResolve(breaks)
    local end_tag = self:makeGotoTag()
-   self:nop()
+   -- landing pad, bypassed by the linker's peephole pass
+   self:addInstruction{opcode = oFlower.op_nop, landing = true}
 
    for break_instr in pairs(breaks) do
       break_instr.goto_tag = end_tag
@@ -229,7 +256,11 @@ function Core:loopBreakResolve(breaks)
 end
 
 function Core:addInstruction(args)
-   self.linker:appendInstruction(args)
+   -- no prefetch across a jump
+   if self.prefetch and (args.goto_tag or args.opcode == oFlower.op_goto) then
+      self.prefetch.slot = nil
+   end
+   return self.linker:appendInstruction(args)
 end
 
 function Core:addDataUINT8(binary, uint8)
@@ -270,17 +301,13 @@ function Core:addDataPAD(binary)
 
    local ii = 0
    while ii < (#binary-1) do
+      -- 8 bytes of data, stored as the fields of an instruction
       self:addInstruction {
-         bytes = {
-            binary[ii+1],
-            binary[ii+2],
-            binary[ii+3],
-            binary[ii+4],
-            binary[ii+5],
-            binary[ii+6],
-            binary[ii+7],
-            binary[ii+8]
-         }
+         arg32_1 = binary[ii+1] + binary[ii+2]*256 + binary[ii+3]*256^2 + binary[ii+4]*256^3,
+         arg8_3 = binary[ii+5],
+         arg8_2 = binary[ii+6],
+         arg8_1 = binary[ii+7],
+         opcode = binary[ii+8]
       }
 
       ii = ii + 8
@@ -355,6 +382,7 @@ function Core:bitori(arg1, val, result)
       arg8_2 = reg.index,
       arg8_3 = result.index,
    }
+   self:freeRegister(reg)
 end
 
 function Core:bitandi(arg1, val, result)
@@ -370,6 +398,7 @@ function Core:bitandi(arg1, val, result)
       arg8_2 = mask.index,
       arg8_3 = result.index,
    }
+   self:freeRegister(mask)
 end
 
 function Core:addi(arg1, val, result)
@@ -385,6 +414,7 @@ function Core:addi(arg1, val, result)
       arg8_2 = reg.index,
       arg8_3 = result.index,
    }
+   self:freeRegister(reg)
 end
 
 function Core:compi(arg1, val, result)
@@ -400,6 +430,7 @@ function Core:compi(arg1, val, result)
       arg8_2 = reg.index,
       arg8_3 = result.index,
    }
+   self:freeRegister(reg)
 end
 
 function Core:shri(arg1, val, result, mode)
@@ -492,6 +523,10 @@ function Core:setreg(reg, val)
 end
 
 function Core:makeGotoTag()
+   -- no prefetch across a jump target
+   if self.prefetch then
+      self.prefetch.slot = nil
+   end
    -- the tag points to next instruction after this function is called
    return {
       name = 'gototag',
@@ -659,11 +694,17 @@ function Core:closePort(port)
 end
 
 function Core:closePortSafe(port)
+   -- the wait below is dead time for the config bus
+   if self.prefetch and self.sensitive_depth == 0 then
+      self.prefetch.slot = self.linker:getLastReference()
+      self.prefetch.unrouted = {}
+   end
    -- safe closing involves checking the status of the port
    self:send_selectModule(blast_bus.area_streamer, blast_bus.addr_mem_streamer_0+port, 0)
    self:getStatus(blast_bus.status_done)
    self:nop()
    self:deActivateStreamerPort(port)
+   self.estimator:sync()
 end
 
 function Core:deActivateStreamerPort(port)
@@ -688,6 +729,7 @@ function Core:activateStreamerPort(port, mode, data, sync)
    -- Coordinates
    self:send_selectModule(blast_bus.area_streamer, blast_bus.addr_mem_streamer_0+port, 2)
    self:send_coordinates(offset_x, offset_y, length_x, length_y, mode)
+   self.estimator:stream(mode, data)
 
    -- Set mode
    self:send_selectModule(blast_bus.area_streamer, blast_bus.addr_mem_streamer_0+port, 0)
@@ -777,6 +819,18 @@ function Core:pushConfig(configContent, configWord)
    }
 end
 
+-- the empty config word closing an instruction or a select: it only
+-- separates two bus transactions, the linker may drop it when another
+-- empty word follows (other empty words are gaps the hardware needs)
+function Core:pushSeparator()
+   self:addInstruction {
+      opcode = oFlower.op_writeConfig,
+      arg8_1 = blast_bus.content_nothing,
+      arg32_1 = 0,
+      separator = true
+   }
+end
+
 function Core:getStatus(statusToGet)
    -- is going to poll the status bus until it gets statusToGet
    -- arg 2 is an optional wait time before starting to read the status
@@ -906,6 +960,7 @@ function Core:readStringFromMem(stream)
       self:ioread(oFlower.io_dma, reg_io_dma)
       self:printReg(reg_io_dma)
    end, reg_io_dma);
+   self:freeRegister(reg_io_dma)
 
    -- done...
    self:closePort(1)
@@ -921,6 +976,7 @@ function Core:ioWaitForReadData(ioCtrl)
    self:bitandi(reg, 0x00000001, reg)
 
    self:loopUntilEndIfZero(reg)
+   self:freeRegister(reg)
 end
 
 function Core:ioWaitForWriteData(ioCtrl)
@@ -933,6 +989,7 @@ function Core:ioWaitForWriteData(ioCtrl)
    self:bitandi(reg, 0x00000002, reg)
 
    self:loopUntilEndIfZero(reg)
+   self:freeRegister(reg)
 end
 
 function Core:printReg(reg)
@@ -972,6 +1029,7 @@ function Core:getCharNonBlocking(reg, tries)
       self:bitandi(reg_stat, 0x00000001, reg_stat)
       self:loopBreakIfNonZero(reg_stat)
    end, reg_stat);
+   self:freeRegister(reg_stat)
 
    self:ioread(oFlower.io_uart, reg)
 end
@@ -1027,6 +1085,7 @@ function Core:resetTime()
    -- set timer ctrl reg to 'restart'
    self:setreg(reg, 1)
    self:iowrite(oFlower.io_timer_ctrl, reg)
+   self:freeRegister(reg)
 end
 
 function Core:getTime()
@@ -1034,6 +1093,7 @@ function Core:getTime()
    -- set timer ctrl reg to ascii readout
    self:setreg(reg, 4 + 2)
    self:iowrite(oFlower.io_timer_ctrl, reg)
+   self:freeRegister(reg)
    -- print header
    self:printraw('--> CPU time = ')
    -- then print timer's result
@@ -1047,6 +1107,84 @@ function Core:getTime()
    self:printraw(string.format(' x %0dns\n\r', self.period_ns))
 end
 
+----------------------------------------------------------------------
+-- device tracing: each event writes a 12-word record (event id on 2
+-- words, then the 9 ascii digits of the timer, one per word, then one
+-- word of padding) into a ring of trace.size records in persistent
+-- memory, through the DMA port.
+-- The timer is restarted by the first event of the program, so
+-- timestamps are relative to the start of the frame.
+--
+function Core:enableTrace(size)
+   size = size or 64
+   self.trace = {
+      size = size,
+      events = {},
+      flushes = {},
+      stream = self.mem:allocPersistentData(torch.Tensor(size, 12):zero())
+   }
+end
+
+function Core:traceEvent(name, kind)
+   local trace = self.trace
+   if not trace then return end
+   table.insert(trace.events, {name = name, kind = kind})
+   local id = #trace.events
+   local slot = (id - 1) % trace.size
+   local record = {
+      x = self.mem:constructCoordinate('persistent', 'x', trace.stream.x.offset + slot*12),
+      y = trace.stream.y,
+      w = 12,
+      h = 1
+   }
+
+   -- latch the timer before the record is written
+   local reg = self:allocRegister()
+   if id == 1 then
+      self:setreg(reg, 1)
+      self:iowrite(oFlower.io_timer_ctrl, reg)
+   end
+   self:setreg(reg, 4 + 2)
+   self:iowrite(oFlower.io_timer_ctrl, reg)
+   self:freeRegister(reg)
+
+   self:openPortWr(1, record)
+   self:executionTimeSensitive(function()
+      self:addInstruction {
+         opcode = oFlower.op_writeStream,
+         arg8_1 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint32,
+         arg32_1 = 1
+      }
+      local binary = {}
+      self:addDataUINT32(binary, id)
+      self:addDataPAD(binary)
+      self:addInstruction {
+         opcode = oFlower.op_routeStream,
+         arg8_1 = oFlower.io_timer,
+         arg8_2 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint8,
+         arg32_1 = 9
+      }
+      self:addInstruction {
+         opcode = oFlower.op_writeStream,
+         arg8_1 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint16,
+         arg32_1 = 1
+      }
+      binary = {}
+      self:addDataUINT16(binary, 0)
+      self:addDataPAD(binary)
+   end)
+   self:closePort(1)
+end
+
+-- the trace is sent after an output: records the nb of events it holds
+function Core:traceFlush()
+   table.insert(self.trace.flushes, #self.trace.events)
+   return self.trace.stream
+end
+
 function Core:sleep(sec)
    assert('number' == type(sec))
 
@@ -1057,7 +1195,7 @@ end
 -- Instuctions:
 function Core:sendInstruction(instruction)
    self:pushConfig(blast_bus.content_instruc, instruction)
-   self:pushConfig(blast_bus.content_nothing, 0)
+   self:pushSeparator()
    --self:pushConfig(blast_bus.content_nothing, 0)
    --self:pushConfig(blast_bus.content_nothing, 0)
 end
@@ -1066,7 +1204,7 @@ function Core:send_setAddr() self:sendInstruction(1) end
 function Core:send_activate() self:sendInstruction(2) end
 function Core:send_deActivate() self:sendInstruction(3) end
 function Core:send_reset() self:sendInstruction(4) end
-function Core:send_pulseToggleControls() self:sendInstruction(5) end
+function Core:send_pulseToggleControls() self:sendInstruction(blast_bus.instruc_pulseToggleControls) end
 function Core:send_control(ctrl) self:sendInstruction(6+ctrl) end
 function Core:send_control_0() self:sendInstruction(6) end
 function Core:send_control_1() self:sendInstruction(7) end
@@ -1082,7 +1220,7 @@ function Core:send_cacheFinish() self:sendInstruction(15) end
 -- Commands:
 function Core:send_selectModule(area, addr, modAddr)
    self:pushConfig(blast_bus.content_command, area*(2^28) + addr*(2^16) + modAddr*(2^8))
-   self:pushConfig(blast_bus.content_nothing, 0)
+   self:pushSeparator()
 end
 
 function Core:send_selectAndCommand(area, addr, modAddr, command)
@@ -1271,6 +1409,10 @@ function Core:configTile(args)
          end
       end
 
+      -- prefetch operator/IO/router configs into the last dead time
+      local prefetch = config.inputs and self:canPrefetchTile(config.address)
+      local prefetch_start = self.linker:getLastReference()
+
       -- constants
       local Z = 15 -- undriven line
       local use_out_2 = false
@@ -1286,6 +1428,7 @@ function Core:configTile(args)
 
          -- operator
          self:send_selectModule(blast_bus.area_tile, config.address, blast_bus.subAddr_operator)
+         if prefetch then self:send_cacheStart() end
 
          -- config operator
          if config.operation then
@@ -1387,6 +1530,7 @@ function Core:configTile(args)
 
          -- connect to global I/Os ?
          self:send_selectModule(blast_bus.area_tile, config.address, blast_bus.subAddr_IO)
+         if prefetch then self:send_cacheStart() end
          -- write global lines:
          local w = {Z,Z,Z,Z,Z,Z,Z,Z}
          for i = 1,3 do
@@ -1419,6 +1563,7 @@ function Core:configTile(args)
 
          -- connect internals
          self:send_selectModule(blast_bus.area_tile, config.address, blast_bus.subAddr_router)
+         if prefetch then self:send_cacheStart() end
          -- to operator:
          local op = {Z,Z,Z}
          local neighbor = {n=Z,e=Z,s=Z,w=Z}
@@ -1507,6 +1652,10 @@ function Core:configTile(args)
          self:pushConfig(blast_bus.content_config,
                          self:concatConfig(4, local_io[1], local_io[2], local_io[3],
                                            neighbor.n, neighbor.e, neighbor.s, neighbor.w))
+
+         if prefetch then
+            self:prefetchTile(config.address, prefetch_start.next)
+         end
       end
 
       -- control
@@ -1533,14 +1682,136 @@ function Core:configTile(args)
             -- deactivate
             self:send_deActivate()
             -- and unconnect IOs
+            local unroute_start = self.linker:getLastReference()
             self:send_selectModule(blast_bus.area_tile, config.address, blast_bus.subAddr_IO)
             self:send_route__all_dummys()
+            if self.prefetch then
+               -- dropped if the next config of this tile is prefetched
+               local unrouted = self.prefetch.unrouted
+               unrouted[config.address] = unrouted[config.address] or {}
+               table.insert(unrouted[config.address], {first = unroute_start.next,
+                                                       last = self.linker:getLastReference()})
+            end
          end
       end
    end)
    end
 end
 
+----------------------------------------------------------------------
+-- Configuration prefetch. Between two layers, the grid is idle while the
+-- tiles of the next layer are configured over the config bus. In a
+-- prefetch scope, the operator/IO/router configs of each tile are written
+-- in cache mode (cacheStart) during the last port synchronization (the
+-- dead time of closePortSafe), and committed in place (cacheFinish).
+--
+function Core:beginConfigPrefetch()
+   self.prefetch = {unrouted = {}, hoisted = 0, instructions = 0, blocked = 0}
+end
+
+function Core:endConfigPrefetch()
+   local prefetch = self.prefetch
+   self.prefetch = nil
+   print('<neuflow.Core> config prefetch: ' .. prefetch.hoisted .. ' tile configs ('
+         .. prefetch.instructions .. ' instructions) moved to dead time, '
+         .. prefetch.blocked .. ' configured in place')
+   return prefetch
+end
+
+-- broadcast and group addresses reach every tile
+local function sameTile(addr1, addr2)
+   return addr1 == addr2
+      or addr1 == blast_bus.addr_broadcast or addr2 == blast_bus.addr_broadcast
+      or addr1 >= blast_bus.addr_grid_0 or addr2 >= blast_bus.addr_grid_0
+end
+
+-- instructions that leave a pending (cached) config untouched
+local cache_safe = {
+   [blast_bus.instruc_config] = true,
+   [blast_bus.instruc_activate] = true,
+   [blast_bus.instruc_deActivate] = true,
+   [blast_bus.instruc_pulseToggleControls] = true
+}
+for ctrl = blast_bus.instruc_control_0,blast_bus.instruc_control_7 do
+   cache_safe[ctrl] = true
+end
+
+-- the config of a tile can be prefetched if nothing else writes to it (or
+-- to all tiles) since the dead time slot. Unrouting that tile is the only
+-- exception: it becomes useless, as long as no stream starts after it.
+function Core:canPrefetchTile(address)
+   local prefetch = self.prefetch
+   if not prefetch or not prefetch.slot then
+      if prefetch then prefetch.blocked = prefetch.blocked + 1 end
+      return false
+   end
+
+   local skip = {}
+   for _,segment in ipairs(prefetch.unrouted[address] or {}) do
+      skip[segment.first] = segment.last
+   end
+
+   local code = self.linker.code
+   local area, addr
+   local unrouted = false
+   local node = prefetch.slot.next
+   while node do
+      if skip[node] then
+         node = skip[node]
+         unrouted = true
+      elseif node.slot and code.opcode[node.slot] == oFlower.op_writeConfig then
+         local content = code.arg8_1[node.slot]
+         local word = code.arg32_1[node.slot]
+         local instruc
+         if content == blast_bus.content_command then
+            area = math.floor(word / 2^28)
+            addr = math.floor(word / 2^16) % 2^12
+            if word % 256 ~= 0 then instruc = word % 256 end
+         elseif content == blast_bus.content_instruc then
+            instruc = word
+         end
+         local tile = (area == blast_bus.area_tile) and sameTile(addr, address)
+         if (tile and content == blast_bus.content_config)
+            or (tile and instruc and not cache_safe[instruc])
+            or (unrouted and area == blast_bus.area_streamer
+                and (instruc == blast_bus.instruc_activate or instruc == blast_bus.instruc_control_1)) then
+            prefetch.blocked = prefetch.blocked + 1
+            return false
+         end
+      end
+      node = node.next
+   end
+   return true
+end
+
+-- moves the config just emitted (from seg_start) to the dead time slot, and
+-- commits it
+function Core:prefetchTile(address, seg_start)
+   local prefetch = self.prefetch
+   local seg_end = self.linker:getLastReference()
+
+   -- unrouting is overwritten by the commit
+   for _,segment in ipairs(prefetch.unrouted[address] or {}) do
+      self.linker:removeSegment(segment.first, segment.last)
+   end
+   prefetch.unrouted[address] = nil
+
+   local node = seg_start
+   while node do
+      prefetch.instructions = prefetch.instructions + 1
+      node = node.next
+   end
+   prefetch.hoisted = prefetch.hoisted + 1
+
+   self.linker:moveTail(prefetch.slot, seg_start)
+   prefetch.slot = seg_end
+
+   for _,sub in ipairs{blast_bus.subAddr_operator, blast_bus.subAddr_IO, blast_bus.subAddr_router} do
+      self:send_selectModule(blast_bus.area_tile, address, sub)
+      self:send_cacheFinish()
+   end
+end
+
 -- Shitty router functions
 function Core:send_route__all_dummys()
    self:pushConfig(blast_bus.content_config, self:concatConfig(4))
@@ -1742,8 +2013,19 @@ end
 --[[ Register Allocator:
 
    Provides a simple way to administer CPU registers when they are used in
-   applications. A closures is created that administers a table of registers
-   and keeps track of in use registers using a weak table.
+   applications. A closure administers a table of physical registers, and
+   hands out register handles.
+
+   Registers are allocated in code order, and released once their value is
+   dead (linear scan over the instruction stream):
+   + freeRegister(reg) releases a register after the last instruction that
+     reads it. If the register was allocated outside the current loop, its
+     value is still read by the next iteration: the release is deferred
+     until the end of that loop (see LoopAdministrator).
+   + registerScope(code, ...) releases all the registers allocated by code
+     that are not freed yet.
+   Handles that are dropped without being freed are reclaimed by the
+   garbage collector when all registers are in use (legacy behavior).
 --]]
 do
    local _all = {
@@ -1760,6 +2042,7 @@ do
    }
 
    local _inuse = setmetatable({}, {__mode="v"})
+   local _scopes = {}
 
    local _find_reg = function()
       for k, reg in pairs( _all ) do
@@ -1767,6 +2050,7 @@ do
             _inuse[k] = {
                name  = "register",
                index = reg,
+               slot  = k,
             }
             return _inuse[k]
          end
@@ -1774,6 +2058,12 @@ do
       return nil
    end
 
+   local _release = function(reg)
+      if _inuse[reg.slot] == reg then
+         _inuse[reg.slot] = nil
+      end
+   end
+
    function Core:allocRegister()
 
       local reg = _find_reg()
@@ -1787,8 +2077,59 @@ do
          end
       end
 
+      -- loop depth at allocation, and enclosing scope
+      reg.depth = #self.ladmin._stack
+      if _scopes[#_scopes] then
+         table.insert(_scopes[#_scopes], reg)
+      end
+
+      local live = 0
+      for k in pairs(_all) do
+         if _inuse[k] then live = live + 1 end
+      end
+      self.register_peak = math.max(self.register_peak, live)
+
       return reg
    end
+
+   function Core:freeRegister(reg)
+      assert('table' == type(reg) and 'register' == reg.name)
+      if reg.freed then return end
+      reg.freed = true
+
+      local stack = self.ladmin._stack
+      if reg.depth < #stack then
+         -- live across the back edge of the loop entered after it
+         local loop = stack[reg.depth + 1]
+         loop.registers = loop.registers or {}
+         table.insert(loop.registers, reg)
+      else
+         _release(reg)
+      end
+   end
+
+   -- called once the back edge of a loop has been emitted
+   function Core:releaseLoopRegisters(loop)
+      for _,reg in ipairs(loop.registers or {}) do
+         reg.depth = #self.ladmin._stack
+         reg.freed = false
+         self:freeRegister(reg)
+      end
+      loop.registers = nil
+   end
+
+   function Core:registerScope(code, ...)
+      table.insert(_scopes, {})
+      local results = {code(...)}
+      for _,reg in ipairs(table.remove(_scopes)) do
+         self:freeRegister(reg)
+      end
+      return unpack(results)
+   end
+
+   function Core:registerPeakUsage()
+      return self.register_peak, #_all
+   end
 end
 
 --[[ Loop Administrator:
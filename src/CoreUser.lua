@@ -110,7 +110,7 @@ function CoreUser:convolBank(inputs, kernels, outputs, coefs)
    end
 
    -- nb of convs
-   local nconvs = grid.nb_convs
+   local nconvs = self.conv_group
 
    -- if more than 1 input, then we do data reuse on the outputs
    if #inputs > 1 and (#inputs*#outputs) == #kernels then
@@ -163,6 +163,13 @@ function CoreUser:convolBank(inputs, kernels, outputs, coefs)
                self:configPort{index = 2, action = 'prefetch', data = outputs[o]}
             end
 
+            -- streamed together: inputs, and the result
+            local streams = {outputs[o]}
+            for i = 1,sim_convs do
+               table.insert(streams, inputs[cur_i+i])
+            end
+            self.mem:recordConcurrentStreams(streams)
+
             self:executionTimeSensitive(function()
                -- config all conv tiles to exec convolutions
                for i = 1,sim_convs do
@@ -495,6 +502,364 @@ function CoreUser:convolBank(inputs, kernels, outputs, coefs)
    end
 end
 
+----------------------------------------------------------------------
+-- chains of conv tiles: a pass streams a set of inputs, each one
+-- broadcast to several convolvers, and accumulates the convolutions
+-- of each output on a chain of ADD tiles. A pass is:
+--   pass.inputs                 input maps
+--   pass.chains[c].output       output map
+--   pass.chains[c].acc          reread the partial sum of the output
+--   pass.chains[c].map          apply coefs (last pass of the output)
+--   pass.chains[c].links[l]     {input = index in pass.inputs, kernel}
+-- Ports: outputs, then partial sums, then inputs.
+--
+local function passPorts(pass)
+   local nb_acc = 0
+   for _,chain in ipairs(pass.chains) do
+      if chain.acc then nb_acc = nb_acc + 1 end
+   end
+   return #pass.chains, nb_acc, #pass.inputs
+end
+
+local function passFits(pass, nb_convs)
+   local nb_out, nb_acc, nb_in = passPorts(pass)
+   local nb_tiles = 0
+   for _,chain in ipairs(pass.chains) do
+      nb_tiles = nb_tiles + #chain.links
+   end
+   return nb_tiles <= nb_convs
+      and nb_out + nb_acc + nb_in <= grid.nb_ios
+      and nb_acc + nb_in <= streamer.max_parallel_rd_streams
+end
+
+function CoreUser:convolChains(pass, coefs)
+   local nb_out, nb_acc, nb_in = passPorts(pass)
+   local acc_port = nb_out
+   local input_port = nb_out + nb_acc
+
+   -- tiles, in chain order
+   local tiles = {}
+   local acc_ports = {}
+   for c,chain in ipairs(pass.chains) do
+      for l,link in ipairs(chain.links) do
+         table.insert(tiles, {chain = c, link = l, input = link.input, kernel = link.kernel})
+      end
+      if chain.acc then
+         acc_port = acc_port + 1
+         acc_ports[c] = acc_port
+      end
+   end
+
+   -- load all kernels
+   for t,tile in ipairs(tiles) do
+      self:configTile{operation = 'CONV2D',
+                      address = t,
+                      inputs = {[2] = {source = t, data = tile.kernel}}}
+      self:configPort{index = t, action = 'fetch+read', data = tile.kernel}
+   end
+
+   -- sync kernels
+   for t = 1,#tiles do
+      self:configPort{index = t, action = 'sync+close'}
+      self:registerKernel{address = t}
+   end
+
+   -- prefetch all inputs, and partial sums
+   for i,input in ipairs(pass.inputs) do
+      self:configPort{index = input_port+i, action = 'prefetch', data = input}
+   end
+   for c,port in pairs(acc_ports) do
+      self:configPort{index = port, action = 'prefetch', data = pass.chains[c].output}
+   end
+
+   -- streamed together: inputs, partial sums and outputs
+   local streams = {}
+   for _,input in ipairs(pass.inputs) do
+      table.insert(streams, input)
+   end
+   for _,chain in ipairs(pass.chains) do
+      table.insert(streams, chain.output)
+   end
+   self.mem:recordConcurrentStreams(streams)
+
+   self:executionTimeSensitive(function()
+      for t,tile in ipairs(tiles) do
+         local chain = pass.chains[tile.chain]
+         local last = (tile.link == #chain.links)
+         local conv_inputs = {[1] = {source = input_port+tile.input, data = pass.inputs[tile.input]},
+                              [2] = {data = tile.kernel}}
+         local bias = 'off'
+         if tile.link == 1 and chain.acc then
+            -- first tile of the chain adds the partial sum
+            conv_inputs[3] = {source = acc_ports[tile.chain], data = chain.output}
+         elseif tile.link == 1 then
+            bias = 'on'
+         end
+         self:configTile{operation = 'CONV2D',
+                         address = t,
+                         config = {bias = bias},
+                         inputs = conv_inputs,
+                         outputs = {[1] = {dest = 'south', data = chain.output}},
+                         control = 3,
+                         activate = true}
+
+         -- ADD chains the conv results of the output
+         if tile.link == 1 then
+            self:configTile{operation = 'ADD',
+                            bypass = true,
+                            address = t,
+                            inputs = {[1] = {source = 'north'}},
+                            outputs = {[1] = {dest = 'east'}}}
+         else
+            self:configTile{operation = 'ADD',
+                            activate = true,
+                            address = t,
+                            inputs = {[1] = {source = 'west'},
+                                      [2] = {source = 'north'}},
+                            outputs = {[1] = {dest = 'east'}}}
+         end
+
+         if not last then
+            -- through mapper: connects ADD[t] to ADD[t+1]
+            self:configTile{operation = 'MAPPING',
+                            address = t,
+                            bypass = true,
+                            inputs = {[1] = {source = 'west'}},
+                            outputs = {[1] = {dest = 'east'}}}
+         elseif chain.map and coefs then
+            -- mapper is used for the last pass of the output
+            self:configTile{operation = 'MAPPING',
+                            address = t,
+                            config = {mode = {even=coefs.even,
+                                              odd=coefs.odd},
+                                      segments = coefs},
+                            inputs = {[1] = {source = 'west'}},
+                            outputs = {[1] = {dest = tile.chain}},
+                            activate = true}
+         else
+            -- through mapper: end of the chain, to its output
+            self:configTile{operation = 'MAPPING',
+                            address = t,
+                            bypass = true,
+                            inputs = {[1] = {source = 'west'}},
+                            outputs = {[1] = {dest = tile.chain}}}
+         end
+      end
+
+      -- config outputs to write results
+      for c,chain in ipairs(pass.chains) do
+         self:configPort{index = c, action = 'write', data = chain.output}
+      end
+
+      -- reread partial sums
+      for _,port in pairs(acc_ports) do
+         self:configPort{index = port, action = 'sync-prefetch'}
+         self:configPort{index = port, action = 'activate'}
+      end
+
+      -- read all inputs, with the same static scheduling as convolBank()
+      for i = 1,nb_in do
+         self:configPort{index = input_port+i, action = 'sync-prefetch'}
+      end
+      for i = 1,nb_in do
+         local delay = 0
+         local clock_ratio = oFlower.clock_freq / grid.clock_freq
+         local fifo_size = 64
+         if nb_acc > 0 and i == 2 then
+            delay = (fifo_size/2 + 16) * clock_ratio
+         elseif i > 2 then
+            delay = 4 * clock_ratio
+         end
+         for j=1,delay do self:nop() end
+         self:configPort{index = input_port+i, action = 'activate'}
+      end
+   end)
+
+   -- synchronize write ports, and close all
+   for c = 1,nb_out do
+      self:configPort{index = c, action = 'sync+close'}
+   end
+   for i = 1,nb_in do
+      self:configPort{index = input_port+i, action = 'close'}
+   end
+   for _,port in pairs(acc_ports) do
+      self:configPort{index = port, action = 'close'}
+   end
+
+   -- deactivate all tiles
+   for t = 1,#tiles do
+      self:configTile{operation = 'CONV2D', address = t, activate = false}
+      self:configTile{operation = 'MAPPING', address = t, activate = false}
+      self:configTile{operation = 'ADD', address = t, activate = false}
+   end
+end
+
+-- picks the shape of the chains for linearBank(): group_o chains of
+-- group_i tiles, with the fewest passes that fit in nb_convs tiles
+local function linearGrouping(nb_inputs, nb_outputs, nb_convs)
+   local best
+   for group_o = 1,math.min(nb_convs, nb_outputs) do
+      local group_i = math.min(math.floor(nb_convs / group_o), nb_inputs)
+      local nb_i_cycles = math.ceil(nb_inputs / group_i)
+      local acc_o = 0
+      if nb_i_cycles > 1 then acc_o = group_o end
+      if group_o + acc_o + group_i <= grid.nb_ios
+      and acc_o + group_i <= streamer.max_parallel_rd_streams then
+         local passes = math.ceil(nb_outputs / group_o) * nb_i_cycles
+         if not best or passes < best.passes then
+            best = {passes = passes, group_o = group_o, group_i = group_i}
+         end
+      end
+   end
+   return best.group_o, best.group_i
+end
+
+-- fully-connected bank: kernels[o][i] are 1x1 kernels. Inputs are read
+-- once per group of outputs, not once per (output, input) pair.
+function CoreUser:linearBank(inputs, kernels, outputs, coefs)
+   -- message
+   if (self.msg_level ~= 'none') then
+      self:message('exec.linear.bank.on.'..
+                   #inputs..'x'..inputs[1].orig_h..'x'..inputs[1].orig_w..'.inputs.and.'..
+                   #outputs..'x'..outputs[1].orig_h..'x'..outputs[1].orig_w..'.outputs')
+   end
+
+   local group_o, group_i = linearGrouping(#inputs, #outputs, self.conv_group)
+   local nb_i_cycles = math.ceil(#inputs / group_i)
+
+   for cur_o = 0,#outputs-1,group_o do
+      for icyc = 1,nb_i_cycles do
+         local cur_i = (icyc-1)*group_i
+         local pass = {inputs = {}, chains = {}}
+         for i = cur_i+1,math.min(cur_i+group_i, #inputs) do
+            table.insert(pass.inputs, inputs[i])
+         end
+         for o = cur_o+1,math.min(cur_o+group_o, #outputs) do
+            local chain = {output = outputs[o], acc = (icyc > 1),
+                           map = (icyc == nb_i_cycles), links = {}}
+            for i = 1,#pass.inputs do
+               table.insert(chain.links, {input = i, kernel = kernels[o][cur_i+i]})
+            end
+            table.insert(pass.chains, chain)
+         end
+
+         -- message
+         if (self.msg_level == 'detailled') then
+            self:message('linear.bank.cycle.'..(cur_o/group_o+1)..'.'..icyc)
+         end
+         self:convolChains(pass, coefs)
+      end
+   end
+end
+
+-- sparse bank: connections[k] = {input, output, kernel}, with indices
+-- into inputs/outputs. Passes are built greedily around the input with
+-- the most pending connections: it is streamed once to all the outputs
+-- it feeds (input stationary), and the remaining tiles extend these
+-- chains with the other inputs they share (output stationary).
+function CoreUser:convolSparseBank(inputs, connections, outputs, coefs)
+   -- message
+   if (self.msg_level ~= 'none') then
+      self:message('exec.sparse.convolution.bank.on.'..
+                   #inputs..'x'..inputs[1].orig_h..'x'..inputs[1].orig_w..'.inputs.and.'..
+                   #outputs..'x'..outputs[1].orig_h..'x'..outputs[1].orig_w..'.outputs')
+   end
+
+   -- pending connections, per output
+   local pending = {}
+   local started = {}
+   for o = 1,#outputs do pending[o] = 0 end
+   for _,conn in ipairs(connections) do
+      pending[conn.output] = pending[conn.output] + 1
+   end
+   local todo = {}
+   for k,conn in ipairs(connections) do todo[k] = conn end
+   local nb_todo = #connections
+
+   local nb_passes = 0
+   while nb_todo > 0 do
+      -- seed: the input feeding the most pending connections
+      local fanout = {}
+      local seed
+      for _,conn in pairs(todo) do
+         fanout[conn.input] = (fanout[conn.input] or 0) + 1
+         if not seed or fanout[conn.input] > fanout[seed]
+         or (fanout[conn.input] == fanout[seed] and conn.input < seed) then
+            seed = conn.input
+         end
+      end
+
+      local pass = {inputs = {}, chains = {}}
+      local input_slot = {}
+      local chain_of = {}
+      local taken = {}
+      local function try(k, conn)
+         local chain = chain_of[conn.output]
+         local new_chain = not chain
+         local new_input = not input_slot[conn.input]
+         if new_chain then
+            chain = {output = outputs[conn.output], acc = started[conn.output] or false, links = {}}
+            table.insert(pass.chains, chain)
+         end
+         if new_input then
+            table.insert(pass.inputs, inputs[conn.input])
+            input_slot[conn.input] = #pass.inputs
+         end
+         table.insert(chain.links, {input = input_slot[conn.input], kernel = conn.kernel})
+         if passFits(pass, self.conv_group) then
+            chain_of[conn.output] = chain
+            taken[k] = conn
+            return true
+         end
+         -- undo
+         table.remove(chain.links)
+         if new_input then
+            table.remove(pass.inputs)
+            input_slot[conn.input] = nil
+         end
+         if new_chain then table.remove(pass.chains) end
+         return false
+      end
+
+      -- (1) the seed input, to as many outputs as possible
+      for k = 1,#connections do
+         local conn = todo[k]
+         if conn and conn.input == seed then try(k, conn) end
+      end
+      -- (2) extend the chains with the inputs they share
+      for k = 1,#connections do
+         local conn = todo[k]
+         if conn and not taken[k] and chain_of[conn.output] and input_slot[conn.input] then
+            try(k, conn)
+         end
+      end
+      for k = 1,#connections do
+         local conn = todo[k]
+         if conn and not taken[k] and chain_of[conn.output] then
+            try(k, conn)
+         end
+      end
+
+      -- commit the pass
+      for k,conn in pairs(taken) do
+         todo[k] = nil
+         nb_todo = nb_todo - 1
+         pending[conn.output] = pending[conn.output] - 1
+      end
+      for o,chain in pairs(chain_of) do
+         chain.map = (pending[o] == 0)
+         started[o] = true
+      end
+
+      -- message
+      nb_passes = nb_passes + 1
+      if (self.msg_level == 'detailled') then
+         self:message('sparse.bank.cycle.'..nb_passes)
+      end
+      self:convolChains(pass, coefs)
+   end
+end
+
 function CoreUser:convolveAndAcc(input, kernel, inputacc, output, opts)
    if (self.msg_level ~= 'none') then
       self:message('exec.convolution.and.mapping.with.'..input.orig_h..'x'..input.orig_w..
@@ -690,31 +1055,32 @@ function CoreUser:copy(input, output)
    self:send_route__all_dummys()
 end
 
-function CoreUser:localNormalizeMean(input, kernel, output)
-   if (self.msg_level ~= 'none') then
-      self:message('exec.normalization.with.'..input.orig_h..'x'..input.orig_w..'.image')
-   end
-
-   if (input.orig_w ~= output.orig_w) or (input.orig_h ~= output.orig_h) then
-      error('<CoreUser:localNormalizeMean> input and output should be the same size')
-   end
-
+-- zero-mean kernel: delta - average, so that a convolution removes the mean
+local function zeroMeanKernel(kernel)
    if not kernel.zero_mean then
-      -- (0) normalize kernel, and compute 1-ker
       local meanRemover = kernel.data
       meanRemover:div(meanRemover:sum())
       meanRemover:mul(-1)
       meanRemover:narrow(1,kernel.data:size(2)-kernel.orig_w+math.ceil(kernel.orig_w/2),1):select(2,math.ceil(kernel.orig_h/2),1):add(1)
-
-      -- (1) make sure kernel would have perfect 0 mean after quantization
       meanRemover:mul(num.one):add(0.5):floor():div(num.one)
       meanRemover:narrow(1,kernel.data:size(2)-kernel.orig_w+math.ceil(kernel.orig_w/2),1):select(2,math.ceil(kernel.orig_h/2),1):add(-meanRemover:sum())
-
-      -- mark kernel as being zero mean
       kernel.zero_mean = true
    end
+end
+
+function CoreUser:localNormalizeMean(input, kernel, output)
+   if (self.msg_level ~= 'none') then
+      self:message('exec.normalization.with.'..input.orig_h..'x'..input.orig_w..'.image')
+   end
 
-   -- (2) remove mean == convolution
+   if (input.orig_w ~= output.orig_w) or (input.orig_h ~= output.orig_h) then
+      error('<CoreUser:localNormalizeMean> input and output should be the same size')
+   end
+
+   -- (0) normalize kernel, and compute 1-ker
+   zeroMeanKernel(kernel)
+
+   -- (1) remove mean == convolution
    self:convolBank({input}, {kernel}, {output})
 end
 
@@ -763,6 +1129,9 @@ function CoreUser:localNormalizeStd(input, kernel, output, threshold)
 
    -- (4) divide
    self:divide(input, output, output)
+
+   -- (5) release temp buffers
+   self.mem:freeManagedData(buffer)
 end
 
 function CoreUser:normKernel(kernel, sum)
@@ -817,6 +1186,9 @@ function CoreUser:localNormalizeMeanBank(inputs, kernels, outputs, xN_coefs)
    for i = 1,#inputs do
       self:subtract(inputs[i], summap[1], outputs[i])
    end
+
+   -- (3) release temp buffers
+   self.mem:freeManagedData(summap)
 end
 
 function CoreUser:localNormalizeStdBank(inputs, kernels, outputs, sqrtCoefs)
@@ -848,51 +1220,325 @@ function CoreUser:localNormalizeStdBank(inputs, kernels, outputs, sqrtCoefs)
    end
 
    -- (3) sum of squares, across features, plus sqrt
-   local sumsquares = { self.mem:allocManagedData(torch.Tensor(inputs[1].orig_h, inputs[1].orig_w)) }
+   local sumSquares = { self.mem:allocManagedData(torch.Tensor(inputs[1].orig_h, inputs[1].orig_w)) }
    self:convolBank(squares, kernels, sumSquares, sqrtCoefs)
 
    -- (4) divide
    for i = 1,#inputs do
       self:divide(inputs[i], sumSquares[1], outputs[i])
    end
+
+   -- (5) release temp buffers
+   self.mem:freeManagedData(squares)
+   self.mem:freeManagedData(sumSquares)
 end
 
-function CoreUser:localNormalizeStdBank(inputs, kernels, outputs, sqrtCoefs)
+----------------------------------------------------------------------
+-- fused local contrast normalization: the intermediate maps (zero-mean,
+-- squares, std) of localNormalizeMean/Std stay on the grid, routed from
+-- tile to tile. Streams are flow-controlled, so an input read twice is
+-- simply held back on its port while the other branch fills up.
+--
+-- one-mean kernel: perfect 1 mean after quantization
+function CoreUser:oneMeanKernel(kernel)
+   if (not kernel.mean) or (kernel.mean ~= 1) then
+      local average = kernel.data:narrow(1,kernel.data:size(2)-kernel.orig_w+1,kernel.orig_w):narrow(2,1,kernel.orig_h)
+      self:normKernel(average)
+      kernel.mean = 1
+   end
+end
+
+-- one feature, in one pass: y = z / sqrt(conv(z^2)), z = conv(x, delta - avg)
+--   conv 1 (z) > ALU 1 (square) > mapper 1 > ALU 2 > conv 2 (avg) > mapper 2 (sqrt)
+--   conv 3 (z) > ALU 3 (divide, by mapper 2) > output
+-- the input is read twice, instead of writing/reading 3 intermediate maps
+function CoreUser:localNormalizeFused(input, kernel_zero, kernel_avg, output, sqrtCoefs)
    if (self.msg_level ~= 'none') then
-      self:message('exec.std.norm.with.'..#inputs..'x'..inputs[1].orig_h..'x'..inputs[1].orig_w..'.image')
+      self:message('exec.fused.norm.with.'..input.orig_h..'x'..input.orig_w..'.image')
+   end
+
+   if (input.orig_w ~= output.orig_w) or (input.orig_h ~= output.orig_h) then
+      error('<CoreUser:localNormalizeFused> input and output should be the same size')
+   end
+
+   -- (0) kernels: zero-mean for conv 1 and 3, one-mean for conv 2
+   zeroMeanKernel(kernel_zero)
+   self:oneMeanKernel(kernel_avg)
+   local kernels = {kernel_zero, kernel_avg, kernel_zero}
+
+   -- (1) load kernels
+   for i = 1,3 do
+      self:configTile{operation = 'CONV2D',
+                      address = i,
+                      inputs = {[2] = {source = i, data = kernels[i]}}}
+      self:configPort{index = i, action = 'fetch+read', data = kernels[i]}
+   end
+   for i = 1,3 do
+      self:configPort{index = i, action = 'sync+close'}
+      self:registerKernel{address = i}
+   end
+
+   -- (2) prefetch input, twice
+   self:configPort{index = 1, action = 'prefetch', data = input}
+   self:configPort{index = 2, action = 'prefetch', data = input}
+
+   self:executionTimeSensitive(function()
+      -- zero-mean, squared, to conv 2
+      self:configTile{operation = 'CONV2D',
+                      address = 1,
+                      config = {bias = 'off'},
+                      inputs = {[1] = {source = 1, data = input},
+                                [2] = {data = kernel_zero}},
+                      outputs = {[1] = {dest = 'south', data = output}},
+                      control = 3,
+                      activate = true}
+      self:configTile{operation = 'SQUARE',
+                      address = 1,
+                      inputs = {[1] = {source = 'north'}},
+                      outputs = {[1] = {dest = 'east'}},
+                      activate = true}
+      self:configTile{operation = 'MAPPING',
+                      address = 1,
+                      bypass = true,
+                      inputs = {[1] = {source = 'west'}},
+                      outputs = {[1] = {dest = 'east'}}}
+      self:configTile{operation = 'ADD',
+                      address = 2,
+                      bypass = true,
+                      inputs = {[1] = {source = 'west'}},
+                      outputs = {[1] = {dest = 'north'}}}
+
+      -- local std
+      self:configTile{operation = 'CONV2D',
+                      address = 2,
+                      config = {bias = 'off'},
+                      inputs = {[1] = {source = 'south', data = input},
+                                [2] = {data = kernel_avg}},
+                      outputs = {[1] = {dest = 'east', data = output}},
+                      control = 3,
+                      activate = true}
+      self:configTile{operation = 'MAPPING',
+                      address = 2,
+                      config = {mode = {even=sqrtCoefs.even,
+                                        odd=sqrtCoefs.odd},
+                                segments = sqrtCoefs},
+                      inputs = {[1] = {source = 'north'}},
+                      outputs = {[1] = {dest = 'east'}},
+                      activate = true}
+
+      -- zero-mean, divided by std
+      self:configTile{operation = 'CONV2D',
+                      address = 3,
+                      config = {bias = 'off'},
+                      inputs = {[1] = {source = 2, data = input},
+                                [2] = {data = kernel_zero}},
+                      outputs = {[1] = {dest = 'south', data = output}},
+                      control = 3,
+                      activate = true}
+      self:configTile{operation = 'DIV',
+                      address = 3,
+                      inputs = {[1] = {source = 'north'},
+                                [2] = {source = 'west'}},
+                      outputs = {[1] = {dest = 3, data = output}},
+                      activate = true}
+
+      -- write output, read inputs
+      self:configPort{index = 3, action = 'write', data = output}
+      self:configPort{index = 1, action = 'sync-prefetch'}
+      self:configPort{index = 2, action = 'sync-prefetch'}
+      self:configPort{index = 1, action = 'activate'}
+      self:configPort{index = 2, action = 'activate'}
+   end)
+
+   -- (3) synchronize write port, and close all
+   self:configPort{index = 3, action = 'sync+close'}
+   self:configPort{index = 1, action = 'close'}
+   self:configPort{index = 2, action = 'close'}
+
+   -- (4) deactivate tiles
+   for i = 1,3 do
+      self:configTile{operation = 'CONV2D', address = i, activate = false}
+      self:configTile{operation = 'MAPPING', address = i, activate = false}
+      self:configTile{operation = 'ADD', address = i, activate = false}
+   end
+end
+
+-- across features: mean and std are shared by all the features, so
+-- they are the only intermediate maps written to memory.
+--   (1) mean = sum_i conv(x_i, avg) / N
+--   (2) std = sqrt(sum_i conv((x_i - mean)^2, avg) / N), one feature per pass:
+--       ALU 1 (subtract) > mapper 1 > ALU 2 (square) > conv 2 (+ partial sum)
+--   (3) y_i = (x_i - mean) / std, two features per pass:
+--       ALU a (subtract) > mapper a > ALU a+1 (divide)
+function CoreUser:localNormalizeSharedBank(inputs, kernels, outputs, xN_coefs, sqrtCoefs)
+   if (self.msg_level ~= 'none') then
+      self:message('exec.shared.norm.with.'..#inputs..'x'..inputs[1].orig_h..'x'..inputs[1].orig_w..'.image')
    end
 
    if (inputs[1].orig_w ~= outputs[1].orig_w) or (inputs[1].orig_h ~= outputs[1].orig_h) then
-      error('<CoreUser:localNormalizeMean> inputs and outputs should be the same size')
+      error('<CoreUser:localNormalizeSharedBank> inputs and outputs should be the same size')
    end
 
-   -- (0) make sure kernels given are one-mean and have perfect 1 mean after quantization
-   for k,kernel in ipairs(kernels) do
-      if (not kernel.mean) or (kernel.mean ~= 1) then
-         local average = kernel.data:narrow(1,kernel.data:size(2)-kernel.orig_w+1,kernel.orig_w):narrow(2,1,kernel.orig_h)
-         self:normKernel(average)
-         kernel.mean = 1
-      end
+   -- (0) make sure kernels given are one-mean
+   for _,kernel in ipairs(kernels) do
+      self:oneMeanKernel(kernel)
    end
 
-   -- (2) square all maps
-   local squares = {}
-   local newlayer = true
-   for i = 1,#kernels do
-      local square = self.mem:allocManagedData(torch.Tensor(inputs[i].orig_h, inputs[i].orig_w))
-      table.insert(squares, square)
-      newlayer = false
-      self:square(inputs[i], squares[i])
+   -- (1) mean across features
+   local mean = self.mem:allocManagedData(torch.Tensor(inputs[1].orig_h, inputs[1].orig_w))
+   self:convolBank(inputs, kernels, {mean}, xN_coefs)
+
+   -- (2) std across features, accumulated in place
+   local std = self.mem:allocManagedData(torch.Tensor(inputs[1].orig_h, inputs[1].orig_w))
+   for i,input in ipairs(inputs) do
+      local acc = (i > 1)
+      local last = (i == #inputs)
+
+      self:configTile{operation = 'CONV2D',
+                      address = 2,
+                      inputs = {[2] = {source = 1, data = kernels[i]}}}
+      self:configPort{index = 1, action = 'fetch+read+sync+close', data = kernels[i]}
+      self:registerKernel{address = 2}
+
+      self:configPort{index = 1, action = 'prefetch', data = input}
+      self:configPort{index = 2, action = 'prefetch', data = mean}
+      if acc then
+         self:configPort{index = 3, action = 'prefetch', data = std}
+      end
+
+      self:executionTimeSensitive(function()
+         self:configTile{operation = 'SUB',
+                         address = 1,
+                         inputs = {[1] = {source = 1, data = input},
+                                   [2] = {source = 2, data = mean}},
+                         outputs = {[1] = {dest = 'east'}},
+                         activate = true}
+         self:configTile{operation = 'MAPPING',
+                         address = 1,
+                         bypass = true,
+                         inputs = {[1] = {source = 'west'}},
+                         outputs = {[1] = {dest = 'east'}}}
+         self:configTile{operation = 'SQUARE',
+                         address = 2,
+                         inputs = {[1] = {source = 'west'}},
+                         outputs = {[1] = {dest = 'north'}},
+                         activate = true}
+
+         local conv_inputs = {[1] = {source = 'south', data = input},
+                              [2] = {data = kernels[i]}}
+         if acc then
+            conv_inputs[3] = {source = 3, data = std}
+         end
+         if last then
+            -- sqrt on the mapper
+            self:configTile{operation = 'CONV2D',
+                            address = 2,
+                            config = {bias = 'off'},
+                            inputs = conv_inputs,
+                            outputs = {[1] = {dest = 'east', data = std}},
+                            control = 3,
+                            activate = true}
+            self:configTile{operation = 'MAPPING',
+                            address = 2,
+                            config = {mode = {even=sqrtCoefs.even,
+                                              odd=sqrtCoefs.odd},
+                                      segments = sqrtCoefs},
+                            inputs = {[1] = {source = 'north'}},
+                            outputs = {[1] = {dest = 4}},
+                            activate = true}
+         else
+            self:configTile{operation = 'CONV2D',
+                            address = 2,
+                            config = {bias = 'off'},
+                            inputs = conv_inputs,
+                            outputs = {[1] = {dest = 4, data = std}},
+                            control = 3,
+                            activate = true}
+         end
+
+         self:configPort{index = 4, action = 'write', data = std}
+         if acc then
+            self:configPort{index = 3, action = 'sync-prefetch'}
+            self:configPort{index = 3, action = 'activate'}
+         end
+         self:configPort{index = 1, action = 'sync-prefetch'}
+         self:configPort{index = 2, action = 'sync-prefetch'}
+         self:configPort{index = 1, action = 'activate'}
+         self:configPort{index = 2, action = 'activate'}
+      end)
+
+      self:configPort{index = 4, action = 'sync+close'}
+      self:configPort{index = 1, action = 'close'}
+      self:configPort{index = 2, action = 'close'}
+      if acc then
+         self:configPort{index = 3, action = 'close'}
+      end
+      self:configTile{operation = 'CONV2D', address = 2, activate = false}
+      for t = 1,2 do
+         self:configTile{operation = 'MAPPING', address = t, activate = false}
+         self:configTile{operation = 'ADD', address = t, activate = false}
+      end
    end
 
-   -- (3) sum of squares, across features, plus sqrt
-   local sumsquares = { self.mem:allocManagedData(torch.Tensor(inputs[1].orig_h, inputs[1].orig_w)) }
-   self:convolBank(squares, kernels, sumSquares, sqrtCoefs)
+   -- (3) divide, by groups of features: ports are mean, std, inputs, outputs
+   local group = math.max(1, math.min(math.floor(grid.nb_alus / 2),
+                                      math.floor((grid.nb_ios - 2) / 2)))
+   for first = 1,#inputs,group do
+      local sim = math.min(group, #inputs - first + 1)
 
-   -- (4) divide
-   for i = 1,#inputs do
-      self:divide(inputs[i], sumSquares[1], outputs[i])
+      self:configPort{index = 1, action = 'prefetch', data = mean}
+      self:configPort{index = 2, action = 'prefetch', data = std}
+      for j = 1,sim do
+         self:configPort{index = 2+j, action = 'prefetch', data = inputs[first+j-1]}
+      end
+
+      self:executionTimeSensitive(function()
+         for j = 1,sim do
+            local a = 2*j-1
+            self:configTile{operation = 'SUB',
+                            address = a,
+                            inputs = {[1] = {source = 2+j, data = inputs[first+j-1]},
+                                      [2] = {source = 1, data = mean}},
+                            outputs = {[1] = {dest = 'east'}},
+                            activate = true}
+            self:configTile{operation = 'MAPPING',
+                            address = a,
+                            bypass = true,
+                            inputs = {[1] = {source = 'west'}},
+                            outputs = {[1] = {dest = 'east'}}}
+            self:configTile{operation = 'DIV',
+                            address = a+1,
+                            inputs = {[1] = {source = 'west'},
+                                      [2] = {source = 2, data = std}},
+                            outputs = {[1] = {dest = 2+group+j, data = outputs[first+j-1]}},
+                            activate = true}
+         end
+
+         for j = 1,sim do
+            self:configPort{index = 2+group+j, action = 'write', data = outputs[first+j-1]}
+         end
+         for p = 1,2+sim do
+            self:configPort{index = p, action = 'sync-prefetch'}
+         end
+         for p = 1,2+sim do
+            self:configPort{index = p, action = 'activate'}
+         end
+      end)
+
+      for j = 1,sim do
+         self:configPort{index = 2+group+j, action = 'sync+close'}
+      end
+      for p = 1,2+sim do
+         self:configPort{index = p, action = 'close'}
+      end
+      for t = 1,2*sim do
+         self:configTile{operation = 'MAPPING', address = t, activate = false}
+         self:configTile{operation = 'ADD', address = t, activate = false}
+      end
    end
+
+   -- (4) release temp buffers
+   self.mem:freeManagedData({mean, std})
 end
 
 function CoreUser:l2pooling(inputs, kernels, outputs, sqrtCoefs)
@@ -921,6 +1567,9 @@ function CoreUser:l2pooling(inputs, kernels, outputs, sqrtCoefs)
 
    -- (3) sum of squares, across features, plus sqrt
    self:convolBank(squares, kernels, outputs, sqrtCoefs)
+
+   -- (4) release temp buffers
+   self.mem:freeManagedData(squares)
 end
 
 function CoreUser:stdOperator(input1, input2, input3, output, op)
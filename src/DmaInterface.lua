@@ -15,6 +15,12 @@ function DmaEthernet:__init(args)
 
    self.msg_level = args.msg_level or 'none'  -- 'detailled' or 'none' or 'concise'
    self.max_packet_size = 1500 or args.max_packet_size
+   -- bound on the wait for the board after a reset (seconds), nil: link default
+   self.reset_timeout = args.reset_timeout
+
+   -- host streams are written to memory by the port itself, as words:
+   -- there is no DMA to widen 8-bit inputs, they are sent in Q8.8
+   self.supports_uint8 = false
 
    -- compulsory
    if (self.core == nil) then
@@ -39,7 +45,7 @@ function DmaEthernet:close()
 end
 
 function DmaEthernet:sendReset()
-   if (-1 == ethertbsp.sendreset()) then
+   if (-1 == ethertbsp.sendreset(self.reset_timeout)) then
       print('<reset> fail')
    end
 end
@@ -99,6 +105,12 @@ function DmaEthernet:host_copyFromDev(tensor)
    self.profiler:lap('copy-from-dev')
 end
 
+-- the device trace follows the outputs, it is not profiled
+function DmaEthernet:host_receiveTrace(tensor)
+   ethertbsp.receivetensor(self.ack_tensor)
+   ethertbsp.receivetensor(tensor[1])
+end
+
 function DmaEthernet:host_sendBytecode(bytecode)
    self.profiler:start('load-bytecode')
    ethertbsp.loadbytecode(bytecode)
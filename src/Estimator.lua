@@ -0,0 +1,203 @@
+----------------------------------------------------------------------
+--- Class: Estimator
+--
+-- This class provides a static performance model of the code generated
+-- by the Core. It is fed by the Core (every stream activated on the
+-- streamer, every port synchronization) and by the Compiler (layer
+-- boundaries), and predicts, for each layer:
+--
+-- (1) the number of grid passes, and their duration: a pass is bound
+--     either by the grid (1 word per cycle per port, at grid.clock_freq)
+--     or by the external memory (streamer.mem_bandwidth_b)
+-- (2) the kernel load overhead (kernels are streamed serially)
+-- (3) the control overhead: every instruction executed by the openFlow
+--     CPU, at Core.period_ns
+--
+-- Host transfers are modeled using the host link parameters of the
+-- platform (host.bandwidth_b, host.latency_s).
+--
+local Estimator = torch.class('neuflow.Estimator')
+
+function Estimator:__init(args)
+   -- args
+   self.core = args.core
+   self.period_s = self.core.period_ns * 1e-9
+
+   -- layers, in execution order
+   self.layers = {}
+   self.depth = 0
+
+   -- host transfers
+   self.transfers = {}
+end
+
+function Estimator:beginLayer(name)
+   self.depth = self.depth + 1
+   if self.depth > 1 then
+      -- nested containers are accounted in the enclosing layer
+      return
+   end
+   self.current = {
+      name = name,
+      passes = 0,
+      grid_s = 0,
+      mem_s = 0,
+      kernels = 0,
+      kernel_s = 0,
+      streamed_b = 0,
+      instr_start = self.core.linker.counter_instructions,
+      pending = {}
+   }
+end
+
+function Estimator:endLayer(ops)
+   self.depth = self.depth - 1
+   if self.depth > 0 then
+      return
+   end
+   local layer = self.current
+   self:sync()
+   layer.ops = ops or 0
+   layer.instructions = self.core.linker.counter_instructions - layer.instr_start
+   layer.ctrl_s = layer.instructions * self.period_s
+   layer.time_s = math.max(layer.grid_s, layer.mem_s) + layer.kernel_s + layer.ctrl_s
+   if layer.ctrl_s > math.max(layer.grid_s, layer.mem_s) then
+      layer.bound = 'ctrl'
+   elseif layer.mem_s > layer.grid_s then
+      layer.bound = 'mem'
+   else
+      layer.bound = 'grid'
+   end
+   layer.pending = nil
+   table.insert(self.layers, layer)
+   self.current = nil
+end
+
+-- a stream was activated on the streamer (mode = 'read' | 'write')
+function Estimator:stream(mode, data)
+   local layer = self.current
+   if not layer then return end
+
+   local size_w = data.w * data.h
+   layer.streamed_b = layer.streamed_b + size_w * streamer.word_b
+
+   if data.packing == 'kernel' then
+      -- kernels are loaded serially, before the convolutions start
+      layer.kernels = layer.kernels + 1
+      layer.kernel_s = layer.kernel_s + size_w / grid.clock_freq
+   else
+      table.insert(layer.pending, {mode = mode, size_w = size_w})
+   end
+end
+
+-- a port is synchronized: all the streams pending form one pass
+function Estimator:sync()
+   local layer = self.current
+   if not layer or #layer.pending == 0 then return end
+
+   local longest_w = 0
+   local read_b = 0
+   local write_b = 0
+   for _,stream in ipairs(layer.pending) do
+      longest_w = math.max(longest_w, stream.size_w)
+      if stream.mode == 'write' then
+         write_b = write_b + stream.size_w * streamer.word_b
+      else
+         read_b = read_b + stream.size_w * streamer.word_b
+      end
+   end
+
+   -- dual memories serve reads and writes concurrently
+   local mem_b = read_b + write_b
+   if memory.is_dual then
+      mem_b = math.max(read_b, write_b)
+   end
+
+   layer.passes = layer.passes + 1
+   layer.grid_s = layer.grid_s + longest_w / grid.clock_freq
+   layer.mem_s = layer.mem_s + mem_b / streamer.mem_bandwidth_b
+   layer.pending = {}
+end
+
+-- a transfer between host and device (direction = 'host->dev' | 'dev->host')
+local function transfer(direction, data, elt_size_b)
+   local size_b = data.orig_w * data.orig_h * (elt_size_b or num.size_b)
+   return {
+      direction = direction,
+      size_b = size_b,
+      time_s = host.latency_s + size_b / host.bandwidth_b
+   }
+end
+
+-- type: 'uint8' for inputs streamed as bytes, Q8.8 otherwise
+function Estimator:hostTransfer(direction, streams, type)
+   local elt_size_b = (type == 'uint8') and 1 or nil
+   for _,data in ipairs(streams) do
+      table.insert(self.transfers, transfer(direction, data, elt_size_b))
+   end
+end
+
+-- all host transfers, and the predicted time of a frame
+local function totals(self, outputs)
+   local transfers = {}
+   local has_output = false
+   for _,t in ipairs(self.transfers) do
+      table.insert(transfers, t)
+      has_output = has_output or (t.direction == 'dev->host')
+   end
+
+   -- outputs are usually copied to the host after the network is compiled
+   if outputs and not has_output then
+      for _,data in ipairs(outputs) do
+         table.insert(transfers, transfer('dev->host', data))
+      end
+   end
+
+   local total_s = 0
+   for _,layer in ipairs(self.layers) do
+      total_s = total_s + layer.time_s
+   end
+   local compute_s = total_s
+   local transfer_s = {['host->dev'] = 0, ['dev->host'] = 0}
+   for _,t in ipairs(transfers) do
+      transfer_s[t.direction] = transfer_s[t.direction] + t.time_s
+      total_s = total_s + t.time_s
+   end
+   return total_s, compute_s, transfer_s
+end
+
+-- predicted time of a frame, in seconds
+function Estimator:total(outputs)
+   return (totals(self, outputs))
+end
+
+function Estimator:report(outputs)
+   local total_s, compute_s, transfer_s = totals(self, outputs)
+
+   local str = '<neuflow.Estimator> static performance estimate:\n'
+   str = str .. string.format('%-32s %8s %6s %9s %7s %8s %10s %5s %6s\n',
+                              'layer', 'MOPs', 'passes', 'streamMB', 'kernels',
+                              'instrs', 'time(ms)', 'bound', 'share')
+   local bottleneck
+   for i,layer in ipairs(self.layers) do
+      str = str .. string.format('%-32s %8.2f %6d %9.3f %7d %8d %10.3f %5s %5.1f%%\n',
+                                 i..':'..layer.name, layer.ops/1e6, layer.passes,
+                                 layer.streamed_b/MB, layer.kernels, layer.instructions,
+                                 layer.time_s*1e3, layer.bound,
+                                 100*layer.time_s/math.max(total_s,1e-12))
+      if not bottleneck or layer.time_s > bottleneck.time_s then
+         bottleneck = layer
+      end
+   end
+   str = str .. string.format('%-32s %10.3f ms\n', 'host->dev transfers', transfer_s['host->dev']*1e3)
+   str = str .. string.format('%-32s %10.3f ms\n', 'dev->host transfers', transfer_s['dev->host']*1e3)
+   str = str .. string.format('%-32s %10.3f ms\n', 'on-board processing', compute_s*1e3)
+   if bottleneck then
+      str = str .. string.format('bottleneck layer: %s (%.1f%% of frame time)\n', bottleneck.name,
+                                 100*bottleneck.time_s/math.max(total_s,1e-12))
+   end
+   str = str .. string.format('predicted throughput: %.2f fps', 1/math.max(total_s,1e-12))
+
+   print(str)
+   return str, total_s
+end
@@ -13,9 +13,25 @@ function Ethernet:__init(args)
    self.core = args.core
    self.msg_level = args.msg_level or 'none'  -- 'detailled' or 'none' or 'concise'
    self.max_packet_size = 1500 or args.max_packet_size
+   -- streams smaller than this are preceded by a sleep on the device
+   self.sleep_threshold_b = args.sleep_threshold_b or 30*30*2
+   -- bound on the wait for the device after a reset (seconds), nil: link default
+   self.reset_timeout = args.reset_timeout
    self.nf = args.nf
    self.profiler = self.nf.profiler
 
+   -- host link: etherflow, or any table with the same API (flowsim.link)
+   self.link = args.link or etherflow
+
+   -- inputs can be streamed as one byte per element (see streamFromHost)
+   self.supports_uint8 = true
+
+   -- credit-based flow control (see initCredits), nil: off
+   self.credit_frames = args.credit_frames
+   if self.credit_frames and self.link.credits then
+      self.link.credits(self.credit_frames)
+   end
+
    -- compulsory
    if (self.core == nil) then
       error('<neuflow.Ethernet> ERROR: requires a Dataflow Core')
@@ -24,18 +40,18 @@ end
 
 function Ethernet:open(network_if_name)
    if(network_if_name) then
-      etherflow.open(network_if_name)
+      self.link.open(network_if_name)
    else
-      etherflow.open()
+      self.link.open()
    end
 end
 
 function Ethernet:close()
-   etherflow.close()
+   self.link.close()
 end
 
 function Ethernet:sendReset()
-   if (-1 == etherflow.sendreset()) then
+   if (-1 == self.link.sendreset(self.reset_timeout)) then
       print('<reset> fail')
    end
 end
@@ -52,10 +68,10 @@ function Ethernet:dev_copyToHost(tensor, ack)
    end
 end
 
-function Ethernet:dev_copyFromHost(tensor)
+function Ethernet:dev_copyFromHost(tensor, type)
    for i = 1,#tensor do
       self.core:executionTimeSensitive(function()
-         self:streamFromHost(tensor[i], 'default')
+         self:streamFromHost(tensor[i], 'default', type)
       end)
    end
 
@@ -67,10 +83,14 @@ function Ethernet:dev_receiveBytecode()
    self:loadByteCode()
 end
 
-function Ethernet:host_copyToDev(tensor)
+function Ethernet:host_copyToDev(tensor, type)
    self.profiler:start('copy-to-dev')
    for i = 1,tensor:size(1) do
-      etherflow.sendtensor(tensor[i])
+      if type == 'uint8' then
+         self.link.sendtensor8(tensor[i])
+      else
+         self.link.sendtensor(tensor[i])
+      end
    end
    self:getFrame('copy-done')
    self.profiler:lap('copy-to-dev')
@@ -83,16 +103,23 @@ function Ethernet:host_copyFromDev(tensor, handshake)
    self.profiler:lap('on-board-processing')
 
    self.profiler:start('copy-from-dev')
-   etherflow.handshake(handshake)
+   self.link.handshake(handshake)
    for i = 1,tensor:size(1) do
-      etherflow.receivetensor(tensor[i])
+      self.link.receivetensor(tensor[i])
    end
    self.profiler:lap('copy-from-dev')
 end
 
+-- the device trace follows the outputs, it is not profiled
+function Ethernet:host_receiveTrace(tensor, handshake)
+   self:getFrame('copy-starting')
+   self.link.handshake(handshake)
+   self.link.receivetensor(tensor[1])
+end
+
 function Ethernet:host_sendBytecode(bytecode)
    self.profiler:start('load-bytecode')
-   etherflow.loadbytecode(bytecode)
+   self.link.loadbytecode(bytecode)
    self.profiler:lap('load-bytecode')
 end
 
@@ -109,6 +136,7 @@ function Ethernet:ethernetBlockOnBusy()
    self.core:ioread(oFlower.io_ethernet_status, reg)
    self.core:bitandi(reg, 0x00000001, reg)
    self.core:gotoTagIfNonZero(goto_tag, reg)
+   self.core:freeRegister(reg)
 end
 
 function Ethernet:ethernetBlockOnIdle()
@@ -118,6 +146,7 @@ function Ethernet:ethernetBlockOnIdle()
    self.core:ioread(oFlower.io_ethernet_status, reg)
    self.core:bitandi(reg, 0x00000001, reg)
    self.core:gotoTagIfZero(goto_tag, reg)
+   self.core:freeRegister(reg)
 end
 
 function Ethernet:ethernetWaitForPacket()
@@ -127,6 +156,46 @@ function Ethernet:ethernetWaitForPacket()
    self.core:ioread(oFlower.io_ethernet_status, reg)
    self.core:bitandi(reg, 0x00000002, reg)
    self.core:gotoTagIfZero(goto_tag, reg)
+   self.core:freeRegister(reg)
+end
+
+----------------------------------------------------------------------
+-- Credit-based flow control: instead of waiting for an ack after each
+-- tensor, the device sends up to credit_frames frames freely, and waits
+-- for a grant (a 64-byte frame) only once its window is used up. The
+-- host sends a grant each time it has received credit_frames frames
+-- (etherflow.credits / flowsim link.credits), so the device only stalls
+-- when the host falls behind. The oFlower can only compare for equality,
+-- and can't read words from the ethernet RX, so credits are counted in
+-- frames, with a fixed window on both sides.
+--
+function Ethernet:initCredits()
+   -- a register for the whole program: the frames left in the window
+   self.credit_reg = self.core:allocRegister()
+   self.core:setreg(self.credit_reg, self.credit_frames)
+end
+
+function Ethernet:ethernetFrameSent()
+   if not self.credit_reg then
+      return
+   end
+   -- one credit used, wait for a grant if it was the last one
+   self.core:addi(self.credit_reg, -1, self.credit_reg)
+   -- forward jump: the tag is resolved once its landing exists
+   local skip = {name = 'gototag'}
+   self.core:gotoTagIfNonZero(skip, self.credit_reg)
+   self:ethernetWaitForPacket()
+   self.core:addInstruction {
+      opcode = oFlower.op_routeStream,
+      arg8_1 = oFlower.io_ethernet,
+      arg8_2 = oFlower.io_uart_status, -- /dev/null
+      arg8_3 = oFlower.type_uint32,
+      arg32_1 = 16
+   }
+   self.core:setreg(self.credit_reg, self.credit_frames)
+   local landing = self.core:makeGotoTag()
+   skip.ref, skip.offset = landing.ref, landing.offset
+   self.core:addInstruction{opcode = oFlower.op_nop, landing = true}
 end
 
 function Ethernet:ethernetStartTransfer(size)
@@ -135,6 +204,7 @@ function Ethernet:ethernetStartTransfer(size)
    status = bit.bor(status, 0x00000001)
    self.core:setreg(reg, status)
    self.core:iowrite(oFlower.io_ethernet_status, reg)
+   self.core:freeRegister(reg)
 end
 
 function Ethernet:printToEthernet(str)
@@ -174,6 +244,7 @@ function Ethernet:printToEthernet(str)
 
    -- (4) make sure it's started
    self:ethernetBlockOnIdle()
+   self:ethernetFrameSent()
 end
 
 function Ethernet:streamToHost(stream, tag, mode)
@@ -197,7 +268,7 @@ function Ethernet:streamToHost(stream, tag, mode)
    end
 
    -- (1) a sleep ?
-   if data_size < 30*30*2 then
+   if data_size < self.sleep_threshold_b then
       self.core:sleep(50e-6)
    end
 
@@ -243,8 +314,10 @@ function Ethernet:streamToHost(stream, tag, mode)
       self:ethernetStartTransfer(packet_size)
       -- (d) wait for transfer started
       self:ethernetBlockOnIdle()
+      self:ethernetFrameSent()
       self.core:addi(reg, -1, reg)
       self.core:gotoTagIfNonZero(goto_tag, reg)
+      self.core:freeRegister(reg)
    end
 
    if(last_packet ~= 0) then
@@ -293,7 +366,7 @@ function Ethernet:streamToHost(stream, tag, mode)
       self:ethernetStartTransfer(packet_size)
       -- (d) wait for transfer started
       self:ethernetBlockOnIdle()
-
+      self:ethernetFrameSent()
    end
 
    -- () wait for transfer complete
@@ -313,8 +386,8 @@ function Ethernet:streamToHost(stream, tag, mode)
          arg8_3 = oFlower.type_uint32,
          arg32_1 = 16
       }
-   elseif mode ~= 'no-ack' then
-      error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack')
+   elseif mode ~= 'no-ack' and mode ~= 'credits' then
+      error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack | credits')
    end
 end
 
@@ -337,7 +410,7 @@ function Ethernet:streamToHost_ack(stream, tag, mode)
    self:printToEthernet(string.format('TX | %s | %0d | %0d', tag, data_size, nb_packets))
 
    -- (1) a sleep ?
-   if data_size < 30*30*2 then
+   if data_size < self.sleep_threshold_b then
       self.core:sleep(50e-6)
    end
 
@@ -384,7 +457,7 @@ function Ethernet:streamToHost_ack(stream, tag, mode)
       self:ethernetStartTransfer(packet_size)
       -- (d) wait for transfer started
       self:ethernetBlockOnIdle()
-
+      self:ethernetFrameSent()
 
       if (not mode) or (mode and mode == 'with-ack') then
          -- (5) get ack
@@ -399,12 +472,13 @@ function Ethernet:streamToHost_ack(stream, tag, mode)
             arg32_1 = 16
          }
          --self:ethernetBlockOnIdle()
-      elseif mode ~= 'no-ack' then
-         error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack')
+      elseif mode ~= 'no-ack' and mode ~= 'credits' then
+         error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack | credits')
       end
 
       self.core:addi(reg, -1, reg)
       self.core:gotoTagIfNonZero(goto_tag, reg)
+      self.core:freeRegister(reg)
       count = count + 1
    end
 
@@ -454,7 +528,7 @@ function Ethernet:streamToHost_ack(stream, tag, mode)
       self:ethernetStartTransfer(packet_size)
       -- (d) wait for transfer started
       self:ethernetBlockOnIdle()
-
+      self:ethernetFrameSent()
 
       if (not mode) or (mode and mode == 'with-ack') then
       -- (5) get ack
@@ -469,8 +543,8 @@ function Ethernet:streamToHost_ack(stream, tag, mode)
          arg32_1 = 16
       }
       --self:ethernetBlockOnIdle()
-      elseif mode ~= 'no-ack' then
-         error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack')
+      elseif mode ~= 'no-ack' and mode ~= 'credits' then
+         error('ERROR <Ethernet> : mode can be one of: with-ack | no-ack | credits')
       end
 
 
@@ -553,6 +627,7 @@ function Ethernet:streamFromHost_legacy(stream, tag)
       -- (d) loopback
       self.core:addi(reg, -1, reg)
       self.core:gotoTagIfNonZero(goto_tag, reg)
+      self.core:freeRegister(reg)
    end
 
    if(last_packet ~= 0) then
@@ -586,9 +661,15 @@ function Ethernet:streamFromHost_legacy(stream, tag)
    self.core:closePort(1)
 end
 
-function Ethernet:streamFromHost(stream, tag)
+--
+-- type 'uint8': the host sends one byte per element, which the DMA
+-- widens to one word (the device then reads a byte v as v/256 in Q8.8).
+-- This halves the host-to-device bandwidth, for 8-bit inputs.
+--
+function Ethernet:streamFromHost(stream, tag, type)
    -- verif data size >= 64
-   local data_size = stream.w * stream.h * 2
+   local uint8 = (type == 'uint8')
+   local data_size = stream.w * stream.h * ((uint8 and 1) or 2)
    if (data_size < 64) then
       error('<neuflow.Ethernet> ERROR: cant stream data packets smaller than 64 bytes')
    end
@@ -614,19 +695,49 @@ function Ethernet:streamFromHost(stream, tag)
    self.core:openPortWr(1, stream)
 
    -- (3) receive data
-   self.core:addInstruction {
-      opcode = oFlower.op_routeStream,
-      arg8_1 = oFlower.io_ethernet,
-      arg8_2 = oFlower.io_dma,
-      arg8_3 = oFlower.type_uint32,
-      arg32_1 = nb_packets*math.ceil(self.max_packet_size / 4)
-   }
+   if uint8 then
+      self.core:addInstruction {
+         opcode = oFlower.op_routeStream,
+         arg8_1 = oFlower.io_ethernet,
+         arg8_2 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint8,
+         arg32_1 = nb_packets*self.max_packet_size
+      }
+   else
+      self.core:addInstruction {
+         opcode = oFlower.op_routeStream,
+         arg8_1 = oFlower.io_ethernet,
+         arg8_2 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint32,
+         arg32_1 = nb_packets*math.ceil(self.max_packet_size / 4)
+      }
+   end
    if (self.msg_level == 'concise') then
       self.core:messagebody('.')
    end
 
    -- (3bis) last packet ?
-   if(last_packet ~= 0) then
+   if(last_packet ~= 0 and uint8) then
+      -- (a) receive data
+      self.core:addInstruction {
+         opcode = oFlower.op_routeStream,
+         arg8_1 = oFlower.io_ethernet,
+         arg8_2 = oFlower.io_dma,
+         arg8_3 = oFlower.type_uint8,
+         arg32_1 = last_packet
+      }
+      -- (b) clean leftovers: packets are padded to 4 bytes, and 64 at least
+      local padding = math.max(64, 4*math.ceil(last_packet / 4)) - last_packet
+      if padding > 0 then
+         self.core:addInstruction {
+            opcode = oFlower.op_routeStream,
+            arg8_1 = oFlower.io_ethernet,
+            arg8_2 = oFlower.io_uart_status,
+            arg8_3 = oFlower.type_uint8,
+            arg32_1 = padding
+         }
+      end
+   elseif(last_packet ~= 0) then
       -- (a) receive data
       self.core:addInstruction {
          opcode = oFlower.op_routeStream,
@@ -673,6 +784,7 @@ function Ethernet:loopBack(size)
 
    -- (c) trigger the sending
    self:ethernetStartTransfer(size)
+   self:ethernetFrameSent()
 end
 
 function Ethernet:streamFromHost_ack(stream, tag)
@@ -728,6 +840,7 @@ function Ethernet:streamFromHost_ack(stream, tag)
       -- (d) loopback
       self.core:addi(reg, -1, reg)
       self.core:gotoTagIfNonZero(goto_tag, reg)
+      self.core:freeRegister(reg)
    end
 
 
@@ -790,7 +903,7 @@ end
 --
 function Ethernet:getFrame(tag, type)
    local data
-   data = etherflow.receivestring()
+   data = self.link.receivestring()
    if (data:sub(1,2) == type) then
       tag_received = self:parse_descriptor(data)
    end
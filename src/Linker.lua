@@ -7,11 +7,36 @@
 --     running on the dataflow computer
 -- (2) data is used by processes
 --
+-- The instructions are kept in a struct of arrays (one C storage per
+-- field, see newSlot), the list only links nodes: a node holds the slot
+-- of its instruction (nil for sentinels), and the goto/memory references
+-- resolved when the bytecode is emitted.
+--
 local Linker = torch.class('neuflow.Linker')
 
+-- initial nb of instruction slots, the storages double when full
+local code_init_size = 4096
+
 function Linker:__init(args)
    -- args
    self.disassemble = args.disassemble
+   self.peephole = (args.peephole ~= false)
+   self.cache_config = args.cache_config or false
+
+   -- nb of instructions appended (for the performance model)
+   self.counter_instructions = 0
+
+   -- the instruction store
+   self.code = {
+      n       = 0,
+      opcode  = torch.ByteStorage(code_init_size),
+      arg8_1  = torch.ByteStorage(code_init_size),
+      arg8_2  = torch.ByteStorage(code_init_size),
+      arg8_3  = torch.ByteStorage(code_init_size),
+      arg32_1 = torch.DoubleStorage(code_init_size)
+   }
+   -- all padding instructions share the same (never rewritten) slot
+   self.padding_slot = self:newSlot{opcode = 0}
 
    -- the bytecode array
    local sentinel_node = {}
@@ -29,7 +54,7 @@ function Linker:__init(args)
 
       -- init padding
       for aa = 0, ((init_offset/8)-1) do
-         self:appendInstruction{bytes = {0,0,0,0,0,0,0,0}}
+         self:appendInstruction{slot = self.padding_slot, pinned = true}
       end
 
       -- Sentinel to seperate init padding from next process
@@ -47,129 +72,77 @@ function Linker:getReference()
    error('# ERROR <Linker:getReference> : Deprecated')
 end
 
-function Linker:linkGotos()
+-- returns the first instruction at or after node: sentinels are skipped in
+-- the next direction, or in the prev direction if the end of the list is
+-- reached. Throw an error if cannot find a non sentinel node.
+local function firstInstruction(node)
+   local reverse = false
+   while nil == node.slot do
+      if node.next and not reverse then
+         node = node.next
+      elseif node.prev then
+         reverse = true
+         node = node.prev
+      else
+         error('# ERROR <Linker:linkGotos> : could not link goto')
+      end
+   end
+   return node
+end
 
-   local goto_table = {}
+function Linker:linkGotos()
    local node = self.instruction_list.start_node
    while node do
       if node.goto_tag then
-         goto_table[node] = node.goto_tag
-      end
+         local ref_node = node.goto_tag.ref
+         local offset = node.goto_tag.offset
 
-      node = node.next
-   end
-
-   for node in pairs(goto_table) do
-      local ref_node = goto_table[node].ref
-      local offset = goto_table[node].offset
-
-      if offset <= 0 then
-         local ii = 0
-         while ii > offset do
-
-            ref_node = ref_node.prev
-            ii = ii - 1
-         end
-      else
-         local ii = 0
-         while ii < offset do
-
-            ref_node = ref_node.next
-            ii = ii + 1
-         end
-      end
-
-      -- if destination node is a sentinel, try linking to a node in the next
-      -- direction, if cannot then in the prev direction. Throw an error if
-      -- cannot find a non sentinel node.
-      function checkNode(ref_node, reverse)
-
-         if nil ~= ref_node.bytes then
-            return ref_node
+         if offset <= 0 then
+            for ii = 1, -offset do
+               ref_node = ref_node.prev
+            end
          else
-            if ref_node.next and not reverse then
-               return checkNode(ref_node.next)
-            elseif ref_node.prev then
-               return checkNode(ref_node.prev, true)
-            else
-               error('# ERROR <Linker:linkGotos> : could not link goto')
+            for ii = 1, offset do
+               ref_node = ref_node.next
             end
          end
-      end
-
-      ref_node = checkNode(ref_node)
 
-      -- remove just processed goto tab from table
-      goto_table[node] = nil
+         -- ref_node is destination instr
+         node.goto_instr = firstInstruction(ref_node)
+      end
 
-      -- ref_node is destination instr
-      node.goto_instr = ref_node
+      node = node.next
    end
 end
 
+-- numbers all the instructions, and lists their slots in program order:
+-- goto addresses and memory offsets are resolved when the bytecode is
+-- emitted
 function Linker:resolveGotos()
-   local addr_index = {}
    local ii = 0
+   local order = {}
+   local refs = {}
 
    local node = self.instruction_list.start_node
    while node do
-      if node.bytes ~= nil then
-         addr_index[node] = ii
+      local slot = node.slot
+      if slot ~= nil then
+         node.addr = ii
          ii = ii + 1
+         order[ii] = slot
+         if node.goto_instr ~= nil or node.mem_offset ~= nil then
+            refs[#refs+1] = node
+         end
       end
 
       node = node.next
    end
 
-   local node = self.instruction_list.start_node
-   while node do
-      if node.goto_instr ~= nil then
-         self:rewriteARG32(node.bytes, addr_index[node.goto_instr])
-      end
-
-      node = node.next
-   end
-
+   self.order = order
+   self.refs = refs
    return ii
 end
 
-function Linker:resolveMemSegments()
-   local node = self.instruction_list.start_node
-
-   while node do
-      if node.mem_offset ~= nil then
-         self:rewriteARG32(node.bytes, node.mem_offset:calc())
-      end
-
-      node = node.next
-   end
-end
-
-function Linker:genBytecode()
-   local node = self.instruction_list.start_node
-   local instruction_output = {}
-   local ii = 0
-
-   while node do
-      if node.bytes ~= nil then
-         instruction_output[ii+1] = node.bytes[1]
-         instruction_output[ii+2] = node.bytes[2]
-         instruction_output[ii+3] = node.bytes[3]
-         instruction_output[ii+4] = node.bytes[4]
-         instruction_output[ii+5] = node.bytes[5]
-         instruction_output[ii+6] = node.bytes[6]
-         instruction_output[ii+7] = node.bytes[7]
-         instruction_output[ii+8] = node.bytes[8]
-
-         ii = ii + 8
-      end
-
-      node = node.next
-   end
-
-   return instruction_output
-end
-
 function Linker:appendSentinel(mode)
    assert('start' == mode or 'end' == mode or nil == mode)
 
@@ -186,47 +159,67 @@ function Linker:appendSentinel(mode)
    self.instruction_list.end_node = new_sentinel
 end
 
-function Linker:appendInstruction(instruction)
-
-   if not instruction.bytes then
-      instruction.bytes = self:newInstructionBytes(instruction)
-   end
+-- appends an instruction: its fields go to the store, and the list gets a
+-- node with its slot and the linker fields only (the args table is not
+-- kept). Returns the node.
+function Linker:appendInstruction(args)
+   local instruction = {
+      slot = args.slot or self:newSlot(args),
+      goto_tag = args.goto_tag,
+      mem_offset = args.mem_offset,
+      pinned = args.pinned,
+      landing = args.landing,
+      separator = args.separator
+   }
 
    local node = self.instruction_list.end_node
 
    node.next = instruction
    instruction.prev = node
    self.instruction_list.end_node = instruction
+
+   self.counter_instructions = self.counter_instructions + 1
+   return instruction
 end
 
-function Linker:newInstructionBytes(args)
-
-   -- parse args
-   local opcode = args.opcode or oFlower.op_nop
-   local arg8_1 = args.arg8_1 or 0
-   local arg8_2 = args.arg8_2 or 0
-   local arg8_3 = args.arg8_3 or 0
-   local arg32_1 = args.arg32_1 or 0
-   local bytes = {}
-
-   -- serialize opcode + args
-   bytes[1] = math.floor(arg32_1/256^0) % 256
-   bytes[2] = math.floor(arg32_1/256^1) % 256
-   bytes[3] = math.floor(arg32_1/256^2) % 256
-   bytes[4] = math.floor(arg32_1/256^3) % 256
-   bytes[5] = arg8_3
-   bytes[6] = arg8_2
-   bytes[7] = arg8_1
-   bytes[8] = opcode
-
-   return bytes
+-- stores an instruction (opcode + args), returns its slot
+function Linker:newSlot(args)
+   local code = self.code
+   local slot = code.n + 1
+   if slot > code.opcode:size() then
+      local size = 2*code.opcode:size()
+      code.opcode:resize(size)
+      code.arg8_1:resize(size)
+      code.arg8_2:resize(size)
+      code.arg8_3:resize(size)
+      code.arg32_1:resize(size)
+   end
+   code.n = slot
+
+   code.opcode[slot] = args.opcode or oFlower.op_nop
+   code.arg8_1[slot] = args.arg8_1 or 0
+   code.arg8_2[slot] = args.arg8_2 or 0
+   code.arg8_3[slot] = args.arg8_3 or 0
+   code.arg32_1[slot] = math.floor(args.arg32_1 or 0) % 2^32
+   return slot
 end
 
-function Linker:rewriteARG32(instr_bytes, uint32)
-   instr_bytes[1] = math.floor(uint32/256^0) % 256
-   instr_bytes[2] = math.floor(uint32/256^1) % 256
-   instr_bytes[3] = math.floor(uint32/256^2) % 256
-   instr_bytes[4] = math.floor(uint32/256^3) % 256
+-- a node for an instruction inserted by the linker passes
+function Linker:newInstruction(args)
+   return {slot = self:newSlot(args)}
+end
+
+-- the fields of the instruction of a node
+function Linker:decode(node)
+   local code = self.code
+   local slot = node.slot
+   return {
+      opcode = code.opcode[slot],
+      arg8_1 = code.arg8_1[slot],
+      arg8_2 = code.arg8_2[slot],
+      arg8_3 = code.arg8_3[slot],
+      arg32_1 = code.arg32_1[slot]
+   }
 end
 
 function Linker:insertInstruction(node, instruction)
@@ -256,84 +249,426 @@ function Linker:removeSegment(seg_start, seg_end)
    later_node.prev = earlier_node
 end
 
-function Linker:alignSensitiveCode(walker)
-   walker = walker or {
-      current_node      = self.instruction_list.start_node,
-      sentinel_start    = nil,
-      sentinel_nesting  = 0,
-      sentinel_size     = 0,
-      bytecode_size     = 0,
-   }
+function Linker:moveTail(earlier_node, seg_start)
+   -- cut everything from seg_start to the end of the list, and re-insert it
+   -- right after earlier_node
+   local seg_end = self.instruction_list.end_node
+   local new_end = seg_start.prev
 
-   if nil == walker.current_node.bytes then
-      -- sentinel
+   new_end.next = nil
+   self.instruction_list.end_node = new_end
 
-      if 'start' == walker.current_node.mode then
-         if 0 == walker.sentinel_nesting then
-            walker.sentinel_start = walker.current_node
-            walker.sentinel_size  = 0
+   self:insertSegment(earlier_node, seg_start, seg_end)
+end
+
+-- lists the outermost time sensitive sections, with their size and the
+-- number of instructions since the end of the previous one
+local function sensitiveSections(list)
+   local sections = {}
+   local section
+   local nesting = 0
+   local before = 0
+   local node = list.start_node
+   while node do
+      if nil == node.slot then
+         if 'start' == node.mode then
+            if 0 == nesting then
+               section = {start = node, size = 0, before = before}
+               before = 0
+            end
+            nesting = nesting + 1
+         elseif 'end' == node.mode then
+            nesting = nesting - 1
+            assert(0 <= nesting)
+            if 0 == nesting then
+               section.stop = node
+               table.insert(sections, section)
+            end
+         end
+      elseif 0 < nesting then
+         section.size = section.size + 1
+      else
+         before = before + 1
+      end
+      node = node.next
+   end
+   return sections
+end
+
+-- padding needed in front of a section starting at instruction pos
+local function sectionPadding(pos, size, page_size)
+   local offset = pos % page_size
+   if offset ~= 0 and offset + size > page_size then
+      return page_size - offset
+   end
+   return 0
+end
+
+-- sensitive sections must not cross a cache page: a section that would
+-- cross one is either pushed to the next page with padding, or, when the
+-- padding is larger than the two jumps needed, moved out of line: it is
+-- replaced by a jump, and all the moved sections are packed into pages
+-- (first fit decreasing) after the end of the program, each followed by
+-- a jump back.
+function Linker:alignSensitiveCode()
+   local page_size = oFlower.page_size_b/8
+   local list = self.instruction_list
+   local sections = sensitiveSections(list)
+
+   -- moving code after the end is only possible if the program never
+   -- falls through its last instruction
+   local code = self.code
+   local last = list.end_node
+   while last and nil == last.slot do
+      last = last.prev
+   end
+   local can_move = last and (code.opcode[last.slot] == oFlower.op_term
+                              or (code.opcode[last.slot] == oFlower.op_goto
+                                  and code.arg8_1[last.slot] == 0))
+
+   -- simulate both layouts
+   local padding_inline = 0
+   local pos_inline = 0
+   local pos = 0
+   local moved = {}
+   for _,section in ipairs(sections) do
+      pos_inline = pos_inline + section.before
+      local pad = sectionPadding(pos_inline, section.size, page_size)
+      padding_inline = padding_inline + pad
+      pos_inline = pos_inline + pad + section.size
+
+      pos = pos + section.before
+      pad = sectionPadding(pos, section.size, page_size)
+      local resume = section.stop.next
+      while resume and nil == resume.slot do
+         resume = resume.next
+      end
+      if can_move and pad > 2 and section.size < page_size and resume then
+         section.resume = resume
+         table.insert(moved, section)
+         pos = pos + 1
+      else
+         pos = pos + pad + section.size
+      end
+   end
+
+   -- move sections out of line, and pack them into pages
+   local bins = {}
+   table.sort(moved, function(a,b) return a.size > b.size end)
+   for _,section in ipairs(moved) do
+      local size = section.size + 1
+      local bin
+      for _,candidate in ipairs(bins) do
+         if candidate.free >= size then
+            bin = candidate
+            break
          end
-         walker.sentinel_nesting = walker.sentinel_nesting + 1
       end
+      if not bin then
+         bin = {free = page_size, sections = {}}
+         table.insert(bins, bin)
+      end
+      bin.free = bin.free - size
+      table.insert(bin.sections, section)
+
+      local jump = self:newInstruction{opcode = oFlower.op_goto}
+      jump.goto_instr = firstInstruction(section.start)
+      local earlier = section.start.prev
+      self:removeSegment(section.start, section.stop)
+      self:insertInstruction(earlier, jump)
+
+      section.back = self:newInstruction{opcode = oFlower.op_goto}
+      section.back.goto_instr = section.resume
+      section.stop.next = section.back
+      section.back.prev = section.stop
+   end
+   for _,bin in ipairs(bins) do
+      local marker = {page_align = true}
+      list.end_node.next = marker
+      marker.prev = list.end_node
+      list.end_node = marker
+      for _,section in ipairs(bin.sections) do
+         self:insertSegment(list.end_node, section.start, section.back)
+         list.end_node = section.back
+      end
+   end
 
-      if 'end' == walker.current_node.mode then
-         walker.sentinel_nesting = walker.sentinel_nesting - 1
-         assert(0 <= walker.sentinel_nesting)
+   -- pad
+   local padding = 0
+   local sentinel_start
+   local sentinel_nesting = 0
+   local sentinel_size = 0
+   local bytecode_size = 0
+
+   local function pad(node, count)
+      for i = 1, count do
+         self:insertInstruction(node, {slot = self.padding_slot})
+         node = node.next
       end
-   else
-      -- instr
-      walker.bytecode_size = walker.bytecode_size + 1
-
-      if 0 < walker.sentinel_nesting then
-         if (1 == (walker.bytecode_size % (oFlower.page_size_b/8))) then
-            -- current node is first of new page
-
-            if walker.sentinel_start ~= walker.current_node.prev then
-               -- shift sensitive section into new page
-               assert((oFlower.page_size_b/8) > walker.sentinel_size)
-
-               local before_sensitive = walker.sentinel_start.next
-               for i = 1, walker.sentinel_size do
-                  self:insertInstruction(before_sensitive, {bytes = {0,0,0,0,0,0,0,0}})
-                  before_sensitive = before_sensitive.next
-                  walker.bytecode_size = walker.bytecode_size + 1
+      bytecode_size = bytecode_size + count
+      padding = padding + count
+      return node
+   end
+
+   local node = list.start_node
+   while node do
+      if nil == node.slot then
+         -- sentinel
+
+         if node.page_align then
+            node = pad(node, (page_size - bytecode_size % page_size) % page_size)
+         end
+
+         if 'start' == node.mode then
+            if 0 == sentinel_nesting then
+               sentinel_start = node
+               sentinel_size  = 0
+            end
+            sentinel_nesting = sentinel_nesting + 1
+         end
+
+         if 'end' == node.mode then
+            sentinel_nesting = sentinel_nesting - 1
+            assert(0 <= sentinel_nesting)
+         end
+      else
+         -- instr
+         bytecode_size = bytecode_size + 1
+
+         if 0 < sentinel_nesting then
+            if (1 == (bytecode_size % page_size)) then
+               -- current node is first of new page
+
+               if sentinel_start ~= node.prev then
+                  -- shift sensitive section into new page
+                  assert(page_size > sentinel_size)
+                  pad(sentinel_start, sentinel_size)
                end
             end
+
+            sentinel_size = sentinel_size + 1
          end
+      end
+
+      node = node.next
+   end
 
-         walker.sentinel_size = walker.sentinel_size + 1
+   print('<neuflow.Linker> sensitive code layout: ' .. #sections .. ' sections, '
+         .. #moved .. ' moved to ' .. #bins .. ' pages, padding: ' .. padding
+         .. ' instructions (' .. padding_inline .. ' inline), jumps added: ' .. 2*#moved)
+   return padding_inline - padding - 2*#moved
+end
+
+----------------------------------------------------------------------
+-- peephole optimizer: rule passes over the linked instruction list.
+-- Runs after linkGotos (gotos point to nodes, not addresses) and
+-- cacheConfigOptimization (which expects the config sequences as the Core
+-- emits them), and before alignSensitiveCode. Empty config words are only
+-- removed when marked as separators (see Core:pushSeparator), other gaps
+-- are timing the hardware relies on. Time-sensitive sections and pinned
+-- instructions are never touched, and a goto target is never removed
+-- (landing pads are first bypassed, by retargeting their gotos).
+--
+local function isConfig(instr, content)
+   return instr.opcode == oFlower.op_writeConfig and instr.arg8_1 == content
+end
+
+-- instructions that use neither the config bus nor the program counter
+local cpu_only = {
+   [oFlower.op_setReg] = true,
+   [oFlower.op_add] = true,
+   [oFlower.op_and] = true,
+   [oFlower.op_or] = true,
+   [oFlower.op_comp] = true,
+   [oFlower.op_shr] = true,
+   [oFlower.op_nop] = true
+}
+
+-- each rule gets an instruction node, its decoded instruction, the next
+-- instruction (nil if the next node is not a plain instruction, i.e. a
+-- sentinel, a goto target or a pinned instruction) and the state of the
+-- pass. It returns the list of nodes to remove, or nil.
+local peephole_rules = {
+   {
+      -- setreg r,a ; setreg r,b => setreg r,b
+      name = 'dead setreg',
+      apply = function(node, instr, next)
+         if instr.opcode == oFlower.op_setReg and next
+            and next.instr.opcode == oFlower.op_setReg
+            and next.instr.arg8_2 == instr.arg8_2 then
+            return {node}
+         end
+      end
+   },
+   {
+      -- a separator followed by an empty config word is redundant
+      name = 'empty config',
+      apply = function(node, instr, next)
+         if node.separator and next
+            and isConfig(next.instr, blast_bus.content_nothing) then
+            return {node}
+         end
+      end
+   },
+   {
+      -- selecting the module that is already selected
+      name = 'redundant select',
+      apply = function(node, instr, next, state)
+         if isConfig(instr, blast_bus.content_command) then
+            local module = instr.arg32_1 - instr.arg32_1 % 256
+            local select_only = (instr.arg32_1 % 256 == 0)
+            if select_only and state.selected == module then
+               if next and next.node.separator then
+                  return {node, next.node}
+               end
+               return {node}
+            end
+            state.selected = module
+         elseif isConfig(instr, blast_bus.content_instruc) then
+            if instr.arg32_1 == blast_bus.instruc_setAdd then
+               state.selected = nil
+            end
+         elseif instr.opcode ~= oFlower.op_writeConfig
+            and instr.opcode ~= oFlower.op_getStatus
+            and not cpu_only[instr.opcode] then
+            state.selected = nil
+         end
+      end
+   }
+}
+
+function Linker:optimizePeephole()
+   -- index goto sources by target
+   local sources = {}
+   local node = self.instruction_list.start_node
+   while node do
+      if node.goto_instr then
+         sources[node.goto_instr] = sources[node.goto_instr] or {}
+         table.insert(sources[node.goto_instr], node)
       end
+      node = node.next
    end
 
-   if walker.current_node.next then
-      walker.current_node = walker.current_node.next
-      return self:alignSensitiveCode(walker)
+   local function plain(node)
+      if node and node.slot and not node.pinned and not sources[node] then
+         return {node = node, instr = self:decode(node)}
+      end
+   end
+
+   local total = 0
+   local stats = {landing = 0}
+   for _,rule in ipairs(peephole_rules) do
+      stats[rule.name] = 0
+   end
+
+   local function remove(node)
+      if node.next then
+         self:removeSegment(node, node)
+      else
+         node.prev.next = nil
+         self.instruction_list.end_node = node.prev
+      end
    end
+
+   -- landing pads: gotos go straight to the next instruction
+   local nesting = 0
+   node = self.instruction_list.start_node
+   while node do
+      local next = node.next
+      if nil == node.slot then
+         if 'start' == node.mode then nesting = nesting + 1 end
+         if 'end' == node.mode then nesting = nesting - 1 end
+      elseif node.landing and nesting == 0 then
+         local target = next
+         while target and nil == target.slot do
+            target = target.next
+         end
+         if target then
+            for _,source in ipairs(sources[node] or {}) do
+               source.goto_instr = target
+               sources[target] = sources[target] or {}
+               table.insert(sources[target], source)
+            end
+            sources[node] = nil
+            remove(node)
+            stats.landing = stats.landing + 1
+            total = total + 1
+         end
+      end
+      node = next
+   end
+
+   -- rule passes, until nothing changes
+   local removed
+   repeat
+      removed = 0
+      local state = {}
+      nesting = 0
+      node = self.instruction_list.start_node
+      while node do
+         local next = node.next
+         if nil == node.slot then
+            if 'start' == node.mode then nesting = nesting + 1 end
+            if 'end' == node.mode then nesting = nesting - 1 end
+            state = {}
+         elseif nesting > 0 or node.pinned or node.goto_tag or sources[node] then
+            state = {}
+         else
+            local instr = self:decode(node)
+            local next_instr = plain(next)
+            for _,rule in ipairs(peephole_rules) do
+               local dead = rule.apply(node, instr, next_instr, state)
+               if dead then
+                  next = dead[#dead].next
+                  for _,dead_node in ipairs(dead) do
+                     remove(dead_node)
+                  end
+                  stats[rule.name] = stats[rule.name] + #dead
+                  removed = removed + #dead
+                  break
+               end
+            end
+         end
+         node = next
+      end
+      total = total + removed
+   until removed == 0
+
+   -- report
+   local str = '<neuflow.Linker> peephole: ' .. total .. ' instructions removed ('
+   for _,rule in ipairs(peephole_rules) do
+      str = str .. rule.name .. ': ' .. stats[rule.name] .. ', '
+   end
+   str = str .. 'landing: ' .. stats.landing .. ', '
+   print(str .. 'saves ' .. total .. ' cycles per pass over the code)')
+   return total, stats
 end
 
 function Linker:dump(info, mem)
+   -- parse argument
+   assert(info.tensor)
+   info.bigendian = info.bigendian or 0
 
    self:linkGotos()
+   if self.cache_config then
+      self:cacheConfigOptimization()
+   end
+   if self.peephole then
+      self:optimizePeephole()
+   end
    self:alignSensitiveCode()
    local instr_nb = self:resolveGotos()
 
    mem:adjustBytecodeSize(instr_nb*8)
 
-   self:resolveMemSegments()
-   local instr = self:genBytecode()
+   -- resolve gotos + mem segments, and emit all the instructions
+   self:dump_instructions(info.tensor)
 
    -- optional disassemble
    if self.disassemble then
-      neuflow.tools.disassemble(instr, {length = #instr})
+      neuflow.tools.disassemble(info.tensor, {length = instr_nb*8})
    end
 
-   -- parse argument
-   assert(info.tensor)
-   info.bigendian = info.bigendian or 0
-
-   -- print all the instructions
-   self:dump_instructions(instr, info.tensor)
-
    -- and embedded data
    self:dump_embedded_data(info, info.tensor, mem)
 
@@ -343,12 +678,72 @@ function Linker:dump(info, mem)
    return self.counter_bytes
 end
 
-function Linker:dump_instructions(instr, tensor)
-   -- copy instructions into tensor
-   for i=1, #instr do
-      tensor[self.counter_bytes+1] = instr[i]
-      self.counter_bytes = self.counter_bytes + 1
+-- emits the instructions listed by resolveGotos: the references are
+-- written into the store, then each field is gathered in program order,
+-- and copied into a strided view of the output (one row per instruction)
+function Linker:dump_instructions(tensor)
+   local code = self.code
+   for _,node in ipairs(self.refs) do
+      if node.goto_instr ~= nil then
+         code.arg32_1[node.slot] = node.goto_instr.addr
+      else
+         code.arg32_1[node.slot] = math.floor(node.mem_offset:calc()) % 2^32
+      end
+   end
+
+   local n = #self.order
+   if n == 0 then return end
+   local order = torch.LongTensor(self.order)
+   local out = torch.ByteTensor(tensor:storage(),
+                                tensor:storageOffset() + self.counter_bytes,
+                                n, 8, 8, 1)
+
+   -- arg32_1, little endian
+   local arg32 = torch.DoubleTensor(code.arg32_1, 1, code.n):index(1, order)
+   local byte = torch.DoubleTensor(n)
+   for j = 0,3 do
+      byte:copy(arg32):div(256^j):floor()
+      byte:add(-256, torch.floor(torch.div(byte, 256)))
+      out:select(2, j + 1):copy(byte)
+   end
+   out:select(2, 5):copy(torch.ByteTensor(code.arg8_3, 1, code.n):index(1, order))
+   out:select(2, 6):copy(torch.ByteTensor(code.arg8_2, 1, code.n):index(1, order))
+   out:select(2, 7):copy(torch.ByteTensor(code.arg8_1, 1, code.n):index(1, order))
+   out:select(2, 8):copy(torch.ByteTensor(code.opcode, 1, code.n):index(1, order))
+
+   self.counter_bytes = self.counter_bytes + n * 8
+end
+
+-- converts values to two's complement fixed point (num.one, num.size_b), and
+-- writes them in tensor at counter_bytes: all the arithmetic is done on
+-- whole tensors, and the bytes are copied into a strided view of the output
+function Linker:dump_fixed_point(values, tensor, bigendian)
+   local n = values:nElement()
+   if n == 0 then return end
+   local modulo = 2^(8*num.size_b)
+
+   -- round to nearest, and wrap negative numbers
+   local fixed = torch.Tensor(n):copy(values):mul(num.one):add(0.5):floor()
+   fixed:add(-modulo, torch.floor(torch.div(fixed, modulo)))
+
+   -- output view: one row per value, one column per byte
+   local out = torch.ByteTensor(tensor:storage(),
+                                tensor:storageOffset() + self.counter_bytes,
+                                n, num.size_b, num.size_b, 1)
+
+   local byte = torch.Tensor(n)
+   for j=0,(num.size_b - 1) do
+      -- get char from short
+      byte:copy(fixed):div(256^j):floor()
+      byte:add(-256, torch.floor(torch.div(byte, 256)))
+      if (bigendian == 1) then
+         out:select(2, num.size_b - j):copy(byte)
+      else
+         out:select(2, j + 1):copy(byte)
+      end
    end
+
+   self.counter_bytes = self.counter_bytes + n * num.size_b
 end
 
 function Linker:dump_embedded_data(info, tensor, mem)
@@ -357,7 +752,7 @@ function Linker:dump_embedded_data(info, tensor, mem)
                       + mem.embedded.start.x * streamer.word_b
 
    for i=1, #mem.embedded do
-      mem_entry = mem.embedded[i]
+      local mem_entry = mem.embedded[i]
 
       -- set offset in file
       if ('number' == type(mem_entry.y)) then
@@ -367,37 +762,9 @@ function Linker:dump_embedded_data(info, tensor, mem)
       end
 
       if (mem_entry.bias ~= nil) then
-         for b = 1,mem_entry.bias:size(1) do
-            dataTwos = math.floor(mem_entry.bias[b] * num.one + 0.5)
-            dataTwos = bit.band(dataTwos, num.mask)
-            for j=0,(num.size_b - 1) do
-               -- get char from short
-               if (info.bigendian == 1) then
-                  tempchar = math.floor(dataTwos / (256^((num.size_b - 1)-j))) % 256
-               else
-                  tempchar = math.floor(dataTwos / (256^j)) % 256
-               end
-               tensor[self.counter_bytes+1] = tempchar
-               self.counter_bytes = self.counter_bytes + 1
-            end
-         end
+         self:dump_fixed_point(mem_entry.bias, tensor, info.bigendian)
       end
 
-      for r=1,mem_entry.data:size(1) do
-         for c=1,mem_entry.data:size(2) do
-            dataTwos = math.floor(mem_entry.data[r][c] * num.one + 0.5)
-            dataTwos = bit.band(dataTwos, num.mask)
-            for j=0,(num.size_b - 1) do
-               -- get char from short
-               if (info.bigendian == 1) then
-                  tempchar = math.floor(dataTwos / (256^((num.size_b - 1)-j))) % 256
-               else
-                  tempchar = math.floor(dataTwos / (256^j)) % 256
-               end
-               tensor[self.counter_bytes+1] = tempchar
-               self.counter_bytes = self.counter_bytes + 1
-            end
-         end
-      end
+      self:dump_fixed_point(mem_entry.data, tensor, info.bigendian)
    end
 end
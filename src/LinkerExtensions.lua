@@ -14,21 +14,24 @@ function neuflow.Linker:cacheConfigOptimization()
    -- Repeat until the end of list is reached
 
 
-   local function bytesDecode(bytes)
+   local code = self.code
+   local function bytesDecode(node)
       -- instr bit packing is hard code, any change in the blast_bus.vh will make errors here
+      local slot = node.slot
+      local word = code.arg32_1[slot]
 
       local instr = {}
-      instr.config8_1 = bytes[1]
-      instr.config8_2 = bytes[2]
-      instr.config8_3 = bytes[3]
-      instr.config8_4 = bytes[4]
-      instr.config16_1 = (256^1)*bytes[4]+(256^0)*bytes[3]
-      instr.config32_1 = (256^3)*bytes[4]+(256^2)*bytes[3]+(256^1)*bytes[2]+(256*0)*bytes[1]
-
-      instr.arg8_3 = bytes[5]
-      instr.arg8_2 = bytes[6]
-      instr.arg8_1 = bytes[7] -- config_content
-      instr.of_opcode = bytes[8] -- openflower opcode
+      instr.config8_1 = word % 256
+      instr.config8_2 = math.floor(word/256) % 256
+      instr.config8_3 = math.floor(word/256^2) % 256
+      instr.config8_4 = math.floor(word/256^3) % 256
+      instr.config16_1 = math.floor(word/256^2)
+      instr.config32_1 = word - word % 256
+
+      instr.arg8_3 = code.arg8_3[slot]
+      instr.arg8_2 = code.arg8_2[slot]
+      instr.arg8_1 = code.arg8_1[slot] -- config_content
+      instr.of_opcode = code.opcode[slot] -- openflower opcode
 
       return instr
    end
@@ -176,36 +179,30 @@ function neuflow.Linker:cacheConfigOptimization()
    end
 
    local function makeCacheSetInstr()
-      local instr_bytes = self:newInstructionBytes {
+      return self:newInstruction {
          opcode = oFlower.op_writeConfig,
          arg8_1 = blast_bus.content_instruc,
          arg32_1 = blast_bus.instruc_cacheStart
       }
-
-      return {bytes = instr_bytes}
    end
 
    local function makeCacheUnsetInstr()
-      local instr_bytes = self:newInstructionBytes {
+      return self:newInstruction {
          opcode = oFlower.op_writeConfig,
          arg8_1 = blast_bus.content_instruc,
          arg32_1 = blast_bus.instruc_cacheFinish
       }
-
-      return {bytes = instr_bytes}
    end
 
    local function makeAddrInstr(addr, submod)
       submod = submod or 0
       local configWord = blast_bus.area_streamer*(2^28) + addr*(2^16) + submod*(2^8)
 
-      local instr_bytes = self:newInstructionBytes {
+      return self:newInstruction {
          opcode = oFlower.op_writeConfig,
          arg8_1 = blast_bus.content_command,
          arg32_1 = configWord
       }
-
-      return {bytes = instr_bytes}
    end
 
    local function findConfigSegment(node, ports)
@@ -216,8 +213,8 @@ function neuflow.Linker:cacheConfigOptimization()
       local search = true
 
       while (search and node) do
-         if node.bytes ~= nil then
-            local instr = bytesDecode(node.bytes)
+         if node.slot ~= nil then
+            local instr = bytesDecode(node)
 
             addressState(instr.of_opcode, instr.arg8_1, instr.config16_1, instr.config8_2, ports)
             portCommand(instr.of_opcode, instr.arg8_1, instr.config8_1, ports)
@@ -229,12 +226,12 @@ function neuflow.Linker:cacheConfigOptimization()
                local nb_config = 0
                while (search and node) do
 
-                  if node.bytes == nil then
+                  if node.slot == nil then
                      search = false
                      break
                   end
 
-                  local instr = bytesDecode(node.bytes)
+                  local instr = bytesDecode(node)
 
                   if portCommand(instr.of_opcode, instr.arg8_1, instr.config8_1, ports) then
                      search = false
@@ -268,7 +265,7 @@ function neuflow.Linker:cacheConfigOptimization()
       while not ports.addr do
          node = node.prev
 
-         local instr = bytesDecode(node.bytes)
+         local instr = bytesDecode(node)
          addressState(instr.of_opcode, instr.arg8_1, instr.config16_1, instr.config8_2, ports)
 
          if ports.addr == target_addr then
@@ -297,8 +294,8 @@ function neuflow.Linker:cacheConfigOptimization()
    local ports = makePorts()
 
    while node do
-      if node.bytes ~= nil then
-         local instr = bytesDecode(node.bytes)
+      if node.slot ~= nil then
+         local instr = bytesDecode(node)
 
          addressState(instr.of_opcode, instr.arg8_1, instr.config16_1, instr.config8_2, ports)
          portCommand(instr.of_opcode, instr.arg8_1, instr.config8_1, ports)
@@ -35,6 +35,8 @@ function Memory:__init(args)
    self.prog_name = args.prog_name
    self.init_offset = (args.init_offset or 0) + 1
    self.bytecode_size_b = 0
+   -- layout of streamed 'auto' buffers: 'auto' (see selectPacking), '1D' or '2D'
+   self.packing = args.packing or 'auto'
 
    -- table of embedded data segments
    self.embedded = {
@@ -78,10 +80,12 @@ function Memory:__init(args)
          ['x'] = 0,
          ['y'] = 0,
       },
-      ['layer'] = {
-         ['h'] = 0,
-         ['packing'] = '1D'
-      },
+      -- segments currently allocated, sorted by address (in words)
+      ['live'] = {},
+      ['peak_live_w'] = 0,
+      -- concurrent streams recorded by the scheduler
+      ['stream_groups'] = 0,
+      ['bank_conflicts'] = 0,
    }
 end
 
@@ -95,21 +99,95 @@ function Memory:adjustBytecodeSize(size_in_bytes)
    self.persistent.start.x = 0
    self.persistent.start.y = self.embedded.start.y + self.embedded.current.y + 1
 
+   -- the managed area starts on a page boundary, so that the banks seen
+   -- at allocation time (relative addresses) are the physical ones
+   local page_r = math.max(1, memory.page_b / streamer.stride_b)
    self.managed.start.x = 0
    self.managed.start.y = self.persistent.start.y + self.persistent.current.y + 1
+   self.managed.start.y = math.ceil(self.managed.start.y / page_r) * page_r
+end
+
+-- DRAM bank of a word address, relative to the managed area
+function Memory:bankOf(addr_w)
+   return math.floor(addr_w / memory.page_w) % memory.nb_banks
+end
+
+-- DRAM bank of the first word of a managed segment (nil for other areas)
+function Memory:segmentBank(segment)
+   if segment.y.start ~= self.managed.start then return nil end
+   return self:bankOf(segment.y.offset * streamer.stride_w + segment.x.offset)
+end
+
+--[[ Record Concurrent Streams
+
+   Called by the scheduler with the segments streamed at the same time by one
+   pass on the grid. Managed segments that start in the same bank are counted
+   as conflicts, reported by printAreaStatistics.
+--]]
+function Memory:recordConcurrentStreams(segments)
+   local seen = {}
+   local banks = {}
+   for _,segment in pairs(segments) do
+      local bank = (not seen[segment]) and self:segmentBank(segment)
+      seen[segment] = true
+      if bank then
+         if banks[bank] then
+            self.managed.bank_conflicts = self.managed.bank_conflicts + 1
+         end
+         banks[bank] = true
+      end
+   end
+   self.managed.stream_groups = self.managed.stream_groups + 1
 end
 
-function Memory:constructCoordinate(area, coor)
+function Memory:constructCoordinate(area, coor, offset)
    return {
       coor = coor,
       start = self[area].start,
-      offset = self[area].current[coor],
+      offset = offset or self[area].current[coor],
       calc = function(self)
          return self.start[self.coor] + self.offset
       end
    }
 end
 
+--[[ Packing selection
+
+   With 'auto' packing (the default for persistent and managed data), the
+   layout of a buffer is chosen from the way it is streamed (access):
+
+   'stream': the whole map in raster order. This covers the grid ports, the
+             convolvers (their windows are built on the grid, from full
+             rows) and Ethernet transfers. 1D packing gives one burst per
+             memory row; a map that fits in a memory row is placed so that
+             it does not cross one.
+
+   'rows':   rows at a fixed pitch (camera DMAs, sub-region reads). 2D
+             packing, if the rows fit in the stride.
+
+   The packing argument of the Memory (a compile option) forces the layout of
+   'stream' buffers.
+--]]
+function Memory:selectPacking(orig_w, orig_h, access)
+   access = access or 'stream'
+   assert(access == 'stream' or access == 'rows')
+   if access == 'stream' and self.packing ~= 'auto' then
+      return self.packing
+   end
+   if access == 'rows' and orig_w <= streamer.stride_w then
+      return '2D'
+   end
+   return '1D'
+end
+
+-- nb of memory rows a 1D segment crosses, beyond the minimum
+function Memory:rowCrossings(segment)
+   if segment.packing ~= '1D' then return 0 end
+   local first = segment.x.offset
+   local rows = math.floor((first + segment.w - 1) / streamer.stride_w) + 1
+   return rows - math.ceil(segment.w / streamer.stride_w)
+end
+
 --[[ Allocate Embedded Data
 
    By default the data is reformatted & treated as a kernel. If non kernel data
@@ -196,7 +274,8 @@ function Memory:allocEmbeddedData(data_, bias_, packing)
       orig_w   = orig_w_,
       orig_h   = orig_h_,
       data     = data_,
-      bias     = bias_
+      bias     = bias_,
+      packing  = packing
    }
 
    self.embedded.current.x = self.embedded.current.x + offset_width
@@ -230,15 +309,20 @@ end
 --[[ Allocate Persistent Data
 
    Data can be transformed to use 1D or 2D packing depending on packing
-   argument. If 2D is selected but the width of the data is larger then the
-   streamer (memory) stride, packing is reverted to 1D.
+   argument, or 'auto' (default) to select it from access (see
+   selectPacking). If 2D is selected but the width of the data is larger
+   then the streamer (memory) stride, packing is reverted to 1D.
 --]]
-function Memory:allocPersistentData(data_, packing)
-   packing = packing or '1D'
-   assert(packing == '1D' or packing == '2D')
+function Memory:allocPersistentData(data_, packing, access)
+   packing = packing or 'auto'
+   assert(packing == '1D' or packing == '2D' or packing == 'auto')
 
    local orig_w_ = data_:size(2)
    local orig_h_ = data_:size(1)
+   local auto = ('auto' == packing)
+   if auto then
+      packing = self:selectPacking(orig_w_, orig_h_, access)
+   end
    local w_
    local h_
    local offset_width
@@ -260,6 +344,11 @@ function Memory:allocPersistentData(data_, packing)
          self.persistent.current.x = 0
          self.persistent.current.y = self.persistent.current.y + self.persistent.layer.h
          self.persistent.layer.h = 0
+      elseif auto and w_ <= streamer.stride_w
+         and (self.persistent.current.x + w_) > streamer.stride_w then
+         -- don't cross a memory row
+         self.persistent.current.x = 0
+         self.persistent.current.y = self.persistent.current.y + 1
       end
    else
       w_ = orig_w_
@@ -288,7 +377,9 @@ function Memory:allocPersistentData(data_, packing)
       h        = h_,
       orig_w   = orig_w_,
       orig_h   = orig_h_,
-      data     = data_
+      data     = data_,
+      packing  = packing,
+      auto     = auto
    }
 
    self.persistent.current.x = self.persistent.current.x + offset_width
@@ -322,22 +413,37 @@ end
 --[[ Allocate Managed Data
 
    Data can be transformed to use 1D or 2D packing depending on packing
-   argument. If 2D is selected but the width of the data is larger then the
-   streamer (memory) stride, packing is reverted to 1D.
-
-   If the end of physical memory is reached, function will start overwriting
-   from the start of the Managed memory space.
+   argument, or 'auto' (default) to select it from access (see
+   selectPacking). If 2D is selected but the width of the data is larger
+   then the streamer (memory) stride, packing is reverted to 1D.
+
+   The segments in peers (optional) will be streamed at the same time as the
+   new one: among the gaps that fit, the first address in a bank used by the
+   fewest peers is chosen. Streams in raster order advance together, so
+   staggered starts keep them in different banks and pages.
+
+   The managed area is seen as a linear array of words (y*stride_w + x). Live
+   segments are kept sorted by address, and a new segment is placed first-fit
+   into the lowest gap that can hold it, so areas released by
+   freeManagedData() are reused by later layers. A 2D segment conservatively
+   reserves the whole span from its first to its last word.
+
+   If no gap is large enough, function will start overwriting from the start
+   of the Managed memory space.
 --]]
-function Memory:allocManagedData(data_, packing)
-   packing = packing or '1D'
-   assert(packing == '1D' or packing == '2D')
+function Memory:allocManagedData(data_, packing, access, peers)
+   packing = packing or 'auto'
+   assert(packing == '1D' or packing == '2D' or packing == 'auto')
 
    local orig_w_ = data_:size(2)
    local orig_h_ = data_:size(1)
+   local auto = ('auto' == packing)
+   if auto then
+      packing = self:selectPacking(orig_w_, orig_h_, access)
+   end
    local w_
    local h_
-   local offset_width
-   local offset_height
+   local span_w
 
    if (('2D' == packing) and (orig_w_ > streamer.stride_w)) then
       print("<neuflow.Memory> WARNING: Current Managed Data tensor cannot be written with 2D packing, switching to 1D.")
@@ -347,79 +453,151 @@ function Memory:allocManagedData(data_, packing)
    if '1D' == packing then
       w_ = orig_w_ * orig_h_
       h_ = 1
-
-      offset_width = w_ % streamer.stride_w
-      offset_height = math.floor(w_ / streamer.stride_w)
-
-      if '1D' ~= self.managed.layer.packing then
-         self.managed.current.x = 0
-         self.managed.current.y = self.managed.current.y + self.managed.layer.h
-         self.managed.layer.h = 0
-      end
+      span_w = w_
    else
       w_ = orig_w_
       h_ = orig_h_
+      span_w = (h_ - 1) * streamer.stride_w + w_
+   end
 
-      offset_width = w_
-      offset_height = h_
+   -- first fit, addresses aligned to physical memory pages
+   local function align(addr)
+      if (addr % streamer.align_w) ~= 0 then
+         addr = (math.floor(addr/streamer.align_w) + 1) * streamer.align_w
+      end
+      -- 2D data must not step out of the line, nor small auto 1D data
+      if ('2D' == packing or (auto and span_w <= streamer.stride_w))
+         and ((addr % streamer.stride_w) + w_) > streamer.stride_w then
+         addr = (math.floor(addr/streamer.stride_w) + 1) * streamer.stride_w
+      end
+      return addr
+   end
 
-      -- check if current data fits in the line
-      if (self.managed.current.x + w_) > streamer.stride_w then
-         self.managed.current.x = 0
-         self.managed.current.y = self.managed.current.y + self.managed.layer.h
-         self.managed.layer.h = 0
+   -- banks used by the peers, and the lowest use
+   local users = {}
+   for b = 0, memory.nb_banks-1 do users[b] = 0 end
+   for _,peer in pairs(peers or {}) do
+      local bank = self:segmentBank(peer)
+      if bank then users[bank] = users[bank] + 1 end
+   end
+   local fewest = math.huge
+   for b = 0, memory.nb_banks-1 do fewest = math.min(fewest, users[b]) end
+
+   -- first address in [addr, stop) in a least used bank
+   local function stagger(addr, stop)
+      while (addr + span_w) <= stop do
+         if users[self:bankOf(addr)] == fewest then return addr end
+         addr = align((math.floor(addr/memory.page_w) + 1) * memory.page_w)
       end
    end
 
-   -- check if there is space in the mem if not start overwriting first layers
-   if (self.managed.current.y + offset_height) > memory.size_r then
-      print("<neuflow.Memory> WARNING: Overwriting the first layers of heap!")
-      self.managed.current.x = 0
-      self.managed.current.y = 0
-      self.managed.layer.h = 0
+   local limit_w = memory.size_r * streamer.stride_w
+   local live = self.managed.live
+   local addr = align(0)
+   local slot
+   local first
+   for i = 1, #live+1 do
+      local stop = (live[i] and live[i].start) or limit_w
+      if (addr + span_w) <= stop then
+         local staggered = stagger(addr, stop)
+         if staggered then
+            addr = staggered
+            slot = i
+            break
+         end
+         first = first or {addr = addr, slot = i}
+      end
+      if live[i] then
+         addr = align(math.max(addr, live[i].stop))
+      end
    end
 
-   -- the layer height is the height of the maximum data area in the layer
-   if self.managed.layer.h < h_ then
-      self.managed.layer.h = h_
+   if not slot and first then
+      -- no gap in a free bank, plain first fit
+      addr = first.addr
+      slot = first.slot
+   elseif not slot then
+      -- no space left in the mem, start overwriting first layers
+      print("<neuflow.Memory> WARNING: Overwriting the first layers of heap!")
+      addr = 0
+      slot = 1
    end
 
-   self.managed[ #self.managed+1 ] = {
-      x        = self:constructCoordinate('managed', 'x'),
-      y        = self:constructCoordinate('managed', 'y'),
+   local segment = {
+      x        = self:constructCoordinate('managed', 'x', addr % streamer.stride_w),
+      y        = self:constructCoordinate('managed', 'y', math.floor(addr / streamer.stride_w)),
       w        = w_,
       h        = h_,
       orig_w   = orig_w_,
       orig_h   = orig_h_,
-      data     = data_
+      data     = data_,
+      packing  = packing,
+      auto     = auto
    }
 
-   self.managed.current.x = self.managed.current.x + offset_width
+   table.insert(live, slot, {start = addr, stop = addr + span_w, segment = segment})
+   self.managed[ #self.managed+1 ] = segment
 
-   if '1D' == packing then
-      self.managed.current.y = self.managed.current.y + offset_height
+   -- keep track of the high water mark
+   self.managed.current.y = math.max(self.managed.current.y,
+                                     math.ceil((addr + span_w) / streamer.stride_w))
+   self.managed.peak_live_w = math.max(self.managed.peak_live_w, self:managedLiveWords())
 
-      --  check if we did not step out of the line
-      if (self.managed.current.x > streamer.stride_w) then
-         self.managed.current.y = self.managed.current.y + 1
-         self.managed.current.x = self.managed.current.x - streamer.stride_w
-      end
+   return segment
+end
+
+--[[ Sub Segment
+
+   A view of orig_h x orig_w words (1D packing) of a 1D segment, from the
+   word 'first' (counted from 0, and aligned). Used to pack several maps in a
+   single buffer.
+--]]
+function Memory:subSegment(segment, first, orig_h, orig_w)
+   assert(segment.packing == '1D' and (first % streamer.align_w) == 0)
+   assert(first + orig_h * orig_w <= segment.w)
+   local addr = segment.y.offset * streamer.stride_w + segment.x.offset + first
+   local function coordinate(coor, offset)
+      return {coor = coor, start = segment[coor].start, offset = offset, calc = segment[coor].calc}
    end
+   return {
+      x        = coordinate('x', addr % streamer.stride_w),
+      y        = coordinate('y', math.floor(addr / streamer.stride_w)),
+      w        = orig_h * orig_w,
+      h        = 1,
+      orig_w   = orig_w,
+      orig_h   = orig_h,
+      packing  = '1D'
+   }
+end
 
-   -- alignment of addresses to physical memory pages
-   if (self.managed.current.x % streamer.align_w) ~= 0 then
-      self.managed.current.x = (math.floor(self.managed.current.x/streamer.align_w) + 1)*streamer.align_w
-      -- and check if we did not step out of the line again
-      if (self.managed.current.x > streamer.stride_w) then
-         self.managed.current.x = 0
-         self.managed.current.y = self.managed.current.y + self.managed.layer.h
-         self.managed.layer.h = 0
+--[[ Free Managed Data
+
+   Releases managed segments (a single segment or a list of segments) so their
+   area can be reused by later allocations. The segment coordinates remain
+   valid, but the contents may be overwritten by anything allocated after this
+   call.
+--]]
+function Memory:freeManagedData(segments)
+   if segments.data then
+      segments = {segments}
+   end
+   local live = self.managed.live
+   for _,segment in ipairs(segments) do
+      for i = 1, #live do
+         if live[i].segment == segment then
+            table.remove(live, i)
+            break
+         end
       end
    end
+end
 
-   self.managed.layer.packing = packing
-
-   return self.managed[#self.managed]
+function Memory:managedLiveWords()
+   local words = 0
+   for _,block in ipairs(self.managed.live) do
+      words = words + (block.stop - block.start)
+   end
+   return words
 end
 
 function Memory:printAreaStatistics()
@@ -445,17 +623,30 @@ function Memory:printAreaStatistics()
    managed_start_b = self.managed.start.y * streamer.stride_b
                    + self.managed.start.x * streamer.word_b
 
+   -- current.y is the high water mark of the heap, in lines
    managed_size_b = self.managed.current.y * streamer.stride_b
-   if (self.managed.current.x ~= 0) then
-      -- if we did not just step a new line
-      -- take into account all the lines we wrote (the last entry's height is enough)
-      -- if not all the lines are filled till the end we are counting more than we should here,
-      -- but for checking collision it's OK
-      managed_size_b = managed_size_b + (self.managed[#self.managed].h * streamer.stride_b)
+
+   local managed_total_b = 0
+   for i = 1, #self.managed do
+      managed_total_b = managed_total_b + self.managed[i].w * self.managed[i].h * streamer.word_b
    end
 
    local binary_size = embedded_start_b+embedded_size_b
 
+   -- layouts: nb of segments per packing, and memory rows crossed
+   local function layouts(area)
+      local count = {['1D'] = 0, ['2D'] = 0, kernel = 0, auto = 0, crossings = 0}
+      for i = 1, #self[area] do
+         local segment = self[area][i]
+         local packing = segment.packing or '1D'
+         count[packing] = count[packing] + 1
+         if segment.auto then count.auto = count.auto + 1 end
+         count.crossings = count.crossings + self:rowCrossings(segment)
+      end
+      return string.format("1D = %5d, 2D = %5d, kernel = %5d, auto = %5d, extra row crossings = %5d",
+                           count['1D'], count['2D'], count.kernel, count.auto, count.crossings)
+   end
+
    print("++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++")
    print(c.Cyan .. '-openFlow-' .. c.Magenta .. ' ConvNet Name ' ..
          c.none ..'[ ' .. self.prog_name .. ' ]\n')
@@ -483,6 +674,22 @@ function Memory:printAreaStatistics()
          managed_size_b,
          memory.size_b)
    )
+   print(
+      string.format("      peak heap usage: peak live = %10d, allocated = %10d, reused = %10d",
+         self.managed.peak_live_w * streamer.word_b,
+         managed_total_b,
+         math.max(0, managed_total_b - managed_size_b))
+   )
+   print("\n        embedded layouts: " .. layouts('embedded'))
+   print("      persistent layouts: " .. layouts('persistent'))
+   print("         managed layouts: " .. layouts('managed'))
+   print(
+      string.format("\n  concurrent streams: %5d passes, %5d bank conflicts (%d banks of %d bytes)",
+         self.managed.stream_groups,
+         self.managed.bank_conflicts,
+         memory.nb_banks,
+         memory.page_b)
+   )
    print(
       string.format("\n  the binary file size should be = %10d, total memory used = %10d",
          binary_size,
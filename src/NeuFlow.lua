@@ -18,6 +18,12 @@ function NeuFlow:__init(args)
    self.global_msg_level = args.global_msg_level or 'none'
    self.mode = args.mode or 'runtime' -- or 'simulation' or 'rom'
    self.use_ethernet = (self.mode == 'runtime')
+   self.simulate = args.simulate or false -- run on flowsim, instead of the device
+   self.input_type = args.input_type or 'q8.8' -- or 'uint8': inputs sent as bytes
+   self.pack_below_b = args.pack_below_b or 32*32*2 -- smaller outputs are packed
+   self.tune = args.tune or 'lookup' -- or 'off', or 'estimate': tune unknown networks
+   self.flow_control = args.flow_control or 'credits' -- or 'ack': one ack per tensor
+   self.credit_frames = args.credit_frames or 64 -- frames sent before waiting for a grant
    if(args.network_if_name) then
       self.network_if_name = args.network_if_name
    end
@@ -33,13 +39,26 @@ function NeuFlow:__init(args)
    args.msg_level = args.core_msg_level or self.global_msg_level
    self.core = neuflow.Core(args)
 
+   -- device trace: per-layer timestamps, sent with the outputs
+   if args.trace then
+      self.core:enableTrace(args.trace_size)
+   end
+
    -- instantiate the compiler, relies on the core
    self.compiler = neuflow.Compiler {
-      optimize_across_layers = true,
+      optimize_across_layers = (args.optimize_across_layers ~= false),
       core = self.core,
       msg_level = args.compiler_msg_level or self.global_msg_level
    }
 
+   -- compile options, tuned per network (see Tuner)
+   self.tuner = neuflow.Tuner {
+      args = args,
+      db = args.tune_db,
+      measure = args.tune_measure,
+      msg_level = args.compiler_msg_level or self.global_msg_level
+   }
+
    -- use a profiler
    self.profiler = neuflow.Profiler()
 
@@ -49,16 +68,33 @@ function NeuFlow:__init(args)
       self.ethernet = neuflow.DmaEthernet {
          msg_level = args.ethernet_msg_level or self.global_msg_level,
          core = self.core,
-         nf = self
+         nf = self,
+         reset_timeout = args.reset_timeout
       }
    else
-      self.handshake = true
+      -- with credits, the host grants frames instead of acking tensors
+      local credits = (self.flow_control == 'credits') and (self.mode == 'runtime')
+      self.handshake = not credits
+      if self.simulate then
+         -- the host link is replaced by the simulator's queue
+         require 'flowsim'
+         self.simulator = flowsim.new(flowsim.params(args.offset_code / oFlower.bus_b))
+         self.use_ethernet = false
+      end
       self.ethernet = neuflow.Ethernet {
          msg_level = args.ethernet_msg_level or self.global_msg_level,
          core = self.core,
-         nf = self
+         nf = self,
+         link = self.simulator and flowsim.link(self.simulator, args.offset_code),
+         sleep_threshold_b = args.sleep_threshold_b,
+         reset_timeout = args.reset_timeout,
+         credit_frames = credits and self.credit_frames or nil
       }
    end
+   if self.simulate and not self.simulator then
+      error('<neuflow.NeuFlow> ERROR: flowsim does not model the DMA Ethernet of '
+            .. self.core.platform)
+   end
 
    if self.core.platform == 'pico_m503' then
       self.camera = neuflow.Camera {
@@ -70,6 +106,9 @@ function NeuFlow:__init(args)
    -- for loops: this retains a list of jump locations
    self.loopTags = {}
 
+   -- host streams (tag + shape), exported with the bytecode
+   self.host_streams = {}
+
    -- ethernet socket (auto found for now)
    if self.use_ethernet then
       print '<neuflow.NeuFlow> loading ethernet driver'
@@ -122,6 +161,10 @@ end
 -- initialize system
 --
 function NeuFlow:initialize(args)
+   -- first, so that every frame sent is counted
+   if self.ethernet.credit_frames then
+      self.ethernet:initCredits()
+   end
    -- args
    if args and args.selftest then
       self.core:bootSequence{selftest=true}
@@ -271,11 +314,22 @@ function NeuFlow:copy(source, dest)
    return dest
 end
 
-function NeuFlow:copyFromHost(source, dest)
+--
+-- type: 'q8.8' (2 bytes per element), or 'uint8' (1 byte per element,
+-- the device reads a byte v as v/256). Defaults to 'uint8' for a
+-- ByteTensor source, to self.input_type otherwise.
+--
+function NeuFlow:copyFromHost(source, dest, type)
    -- if no dest, create it
    if not dest then
       dest = self:allocHeap(source)
    end
+   type = type or (torch.typename(source) == 'torch.ByteTensor' and 'uint8') or self.input_type
+   if type == 'uint8' and not self.ethernet.supports_uint8 then
+      print('<neuflow.NeuFlow> WARNING: ' .. self.core.platform
+            .. ' cannot stream 8-bit inputs, using Q8.8')
+      type = 'q8.8'
+   end
    -- check if dest is a list of streams, or a stream
    local ldest
    if #dest == 0 then
@@ -291,18 +345,43 @@ function NeuFlow:copyFromHost(source, dest)
       self:copy(source,ldest)
    else
       -- process list of streams
-      print('<neuflow.NeuFlow> copy host->dev: ' .. #ldest .. 'x' .. ldest[1].orig_h .. 'x' .. ldest[1].orig_w)
-
-      self.ethernet:dev_copyFromHost(ldest)
+      print('<neuflow.NeuFlow> copy host->dev [' .. type .. ']: ' .. #ldest .. 'x' .. ldest[1].orig_h .. 'x' .. ldest[1].orig_w)
+
+      self.core:traceEvent('copy-from-host', 'begin')
+      self.ethernet:dev_copyFromHost(ldest, type)
+      self.core:traceEvent('copy-from-host', 'end')
+      self.core.estimator:hostTransfer('host->dev', ldest, type)
+      table.insert(self.host_streams, {tag = 'input', n = #ldest,
+                                       h = ldest[1].orig_h, w = ldest[1].orig_w,
+                                       type = type})
    end
 
    return dest
 end
 
+--
+-- Several outputs smaller than pack_below_b bytes are first copied on the
+-- device into one staging buffer, one slot per map (aligned, see
+-- packedSlot), and sent as a single stream: one descriptor and one ack for
+-- all the maps. copyFromDev() unpacks them.
+--
+local function packedSlot(h, w)
+   return math.ceil(h * w / streamer.align_w) * streamer.align_w
+end
+
+-- words of the staging buffer (the Ethernet streams 64 bytes at least)
+local function packedSize(n, h, w)
+   return math.max(n * packedSlot(h, w), 32)
+end
+
 function NeuFlow:copyToHost(source, dest)
-   -- no ack in simulation
+   -- no ack in simulation, credits replace the acks when enabled
    local ack
-   if self.mode == 'simulation' or (not self.handshake) then
+   if self.mode == 'simulation' then
+      ack = 'no-ack'
+   elseif self.ethernet.credit_frames then
+      ack = 'credits'
+   elseif not self.handshake then
       ack = 'no-ack'
    end
 
@@ -321,7 +400,39 @@ function NeuFlow:copyToHost(source, dest)
    -- process list of streams
    print('<neuflow.NeuFlow> copy dev->host: ' .. #lsource .. 'x' .. lsource[1].orig_h .. 'x' .. lsource[1].orig_w)
 
-   self.ethernet:dev_copyToHost(lsource, ack)
+   local seg_start = self.core.linker:getLastReference()
+   self.core:traceEvent('copy-to-host', 'begin')
+   -- several small maps share one transfer; a lone map is only copied when
+   -- it is below the 64 bytes the Ethernet can stream
+   local map_b = orig_h * orig_w * 2
+   local packed = ((#lsource > 1) and (map_b < self.pack_below_b)) or (map_b < 64)
+   local streams = lsource
+   if packed then
+      local slot = packedSlot(orig_h, orig_w)
+      local staging = self.core.mem:allocManagedData(torch.Tensor(1, packedSize(#lsource, orig_h, orig_w)), '1D')
+      for i = 1,#lsource do
+         self.core:copy(lsource[i], self.core.mem:subSegment(staging, (i-1)*slot, orig_h, orig_w))
+      end
+      streams = {staging}
+   end
+   self.ethernet:dev_copyToHost(streams, ack)
+   self.core:traceEvent('copy-to-host', 'end')
+   if self.core.trace then
+      self.ethernet:dev_copyToHost({self.core:traceFlush()}, ack)
+   end
+
+   if self.loopTags.send_point then
+      -- pipelined loop: move the transfer to the top of the loop
+      seg_start = seg_start.next
+      local seg_end = self.core.linker:getLastReference()
+      self.core.linker:moveTail(self.loopTags.send_point, seg_start)
+      self.loopTags.send_point = seg_end
+      self.loopTags.entry.ref = seg_end
+      table.insert(self.pipeline.outputs, torch.Tensor(#lsource, orig_h, orig_w))
+   end
+   self.core.estimator:hostTransfer('dev->host', streams)
+   table.insert(self.host_streams, {tag = 'output', n = #lsource, h = orig_h, w = orig_w,
+                                    type = packed and 'packed' or nil})
 
    -- create/resize dest
    if not dest then
@@ -343,23 +454,68 @@ function NeuFlow:compile(network, input)
       inputs = input
    end
 
+   -- tuned compile options
+   if self.tune ~= 'off' then
+      local options = self.tuner:lookup(network, inputs)
+      if not options and self.tune == 'estimate' then
+         options = self.tuner:tune(network, inputs)
+      end
+      if options then
+         self:applyOptions(options)
+      end
+   end
+
    local outputs
    outputs, self.gops = self.compiler:processNetwork(network, inputs)
 
    return outputs
 end
 
+-- compile options (see Tuner), also accepted as args of NeuFlow
+function NeuFlow:applyOptions(options)
+   self.compiler.opt_across_layers = options.optimize_across_layers
+   self.core.conv_group = math.min(options.conv_group, grid.nb_convs)
+   self.core.mem.packing = options.packing
+   self.core.linker.cache_config = options.cache_config
+   self.ethernet.sleep_threshold_b = options.sleep_threshold_b
+end
+
 ----------------------------------------------------------------------
 -- high-level GOTO functions
 --
-function NeuFlow:beginLoop(tag)
+--[[ Loops
+
+   In 'pipelined' mode, the code generated by copyToHost() is moved to the
+   top of the loop body, and the first iteration jumps over it. The device
+   then sends the outputs of frame N-1 right before receiving frame N, and
+   computes frame N while the host is busy with the outputs of frame N-1.
+   On the host side, copyToDev() first collects the pending outputs, and
+   copyFromDev() returns them: outputs lag one frame behind inputs.
+--]]
+function NeuFlow:beginLoop(tag, mode)
+   if mode == 'pipelined' then
+      -- no outputs to send on the first iteration
+      -- (the entry tag is moved past the transfers by copyToHost)
+      local entry = {name = 'gototag', offset = 1}
+      self.core:gotoTag(entry)
+      entry.ref = self.core.linker:getLastReference()
+      self.loopTags.entry = entry
+      self.loopTags.send_point = entry.ref
+      self.pipeline = {outputs = {}, staged = {}, in_flight = false}
+   end
    self.loopTags.tag = self.core:makeGotoTag()
    self.loopTags.tag.offset = 1
+   -- registers live across iterations are kept until the end of the loop
+   self.loopTags.loop = {}
+   self.core.ladmin:push(self.loopTags.loop)
 end
 
 function NeuFlow:endLoop(tag)
    self.core:defaults()
    self.core:gotoTag(self.loopTags.tag)
+   self.core.ladmin:pop()
+   self.core:releaseLoopRegisters(self.loopTags.loop)
+   self.loopTags.send_point = nil
 end
 
 function NeuFlow:term()
@@ -391,7 +547,7 @@ function NeuFlow:writeBytecode(args)
    -- generate all outputs
    for _,args in ipairs(args) do
       -- args
-      local format = args.format or 'bin' -- or 'hex'
+      local format = args.format or 'bin' -- or 'hex' | 'rom' | 'container'
       local width = args.width or 8
       local length = args.length
 
@@ -404,8 +560,19 @@ function NeuFlow:writeBytecode(args)
       elseif format == 'rom' then
          local filev = self.prog_name ..'.v'
          neuflow.tools.readBinWriteRom(filepath, filev, width, 'flow_rom')
+      elseif format == 'container' then
+         local mem = self.core.mem
+         neuflow.tools.writeContainer(self.prog_name .. '.nfc', {
+            image = tensor,
+            image_size = tensor_size,
+            instructions_size = mem.bytecode_size_b,
+            embedded_offset = mem.embedded.start.y * streamer.stride_b,
+            platform = self.core.platform,
+            prog_name = self.prog_name,
+            streams = self.host_streams
+         })
       else
-         error('format should be one of: bin | hex')
+         error('format should be one of: bin | hex | rom | container')
       end
    end
 
@@ -416,7 +583,11 @@ end
 -- execute simulation (testbench)
 --
 function NeuFlow:execSimulation(args)
-   local testbench = args.testbench or error('please provide a testbench script')
+   args = args or {}
+   if not args.testbench then
+      return self:execFlowsim(args)
+   end
+   local testbench = args.testbench
    local cache_hex = args.cache_hex or error('please provide path for cache hex mask')
    local mem_hex = args.mem_hex or error('please provide path for mem hex mask')
 
@@ -446,6 +617,33 @@ function NeuFlow:execSimulation(args)
    print(c.none)
 end
 
+----------------------------------------------------------------------
+-- execute simulation (flowsim): the bytecode is run until the term
+-- instruction, and the UART output is printed. Returns the simulator,
+-- which can be inspected (stats(), readmem())
+--
+function NeuFlow:execFlowsim(args)
+   require 'flowsim'
+   local offset_code = self.core.offset_code
+   local sim = self.simulator or flowsim.new(flowsim.params(offset_code / oFlower.bus_b))
+
+   print('<neuflow.NeuFlow> running compiled bytecode in flowsim')
+   local bytecode = self:writeBytecode{}
+   sim:load(bytecode, offset_code)
+   sim:reset()
+   local state, err = sim:run(args.max_instructions)
+   io.write(sim:uart())
+   if state == 'error' then
+      error('<neuflow.NeuFlow> ERROR: flowsim: ' .. err)
+   elseif state ~= 'halted' then
+      print('<neuflow.NeuFlow> flowsim stopped: ' .. state)
+   end
+   local stats = sim:stats()
+   print(string.format('<neuflow.NeuFlow> flowsim: %d instructions, %d cycles, %d grid words',
+                       stats.instructions, stats.cycles, stats.grid_words))
+   return sim
+end
+
 ----------------------------------------------------------------------
 -- transmit reset
 --
@@ -482,10 +680,28 @@ function NeuFlow:loadBytecode(bytecode)
 end
 
 ----------------------------------------------------------------------
--- transmit bytecode (from file)
+-- transmit bytecode (from file): containers (.nfc) are mapped and sent
+-- as is, raw binaries are padded to the bytecode size
 --
 function NeuFlow:loadBytecodeFromFile(filename)
-   local file = assert(io.open(filename, "r"))
+   local container = neuflow.tools.readContainer(filename)
+   if container then
+      if container.platform ~= self.core.platform then
+         error('<neuflow.NeuFlow> ERROR: bytecode was compiled for platform '
+               .. container.platform .. ', not ' .. self.core.platform)
+      end
+      if container.load_size ~= self.bytecodesize then
+         error('<neuflow.NeuFlow> ERROR: bytecode image is ' .. container.load_size
+               .. ' bytes, bootloader expects ' .. self.bytecodesize)
+      end
+      print('<neuflow.NeuFlow> loading ' .. container.prog_name .. ' ('
+            .. container.compiler .. ', ' .. container.image_size .. ' bytes)')
+      self.host_streams = container.streams
+      self:loadBytecode(container.image)
+      return container
+   end
+
+   local file = assert(io.open(filename, "rb"))
    local tensor = self:convertBytecodeString(file:read("*all"))
    file:close()
 
@@ -493,11 +709,11 @@ function NeuFlow:loadBytecodeFromFile(filename)
 end
 
 function NeuFlow:convertBytecodeString(bytes)
-   local tensor = torch.ByteTensor(self.bytecodesize)
-   local i = 1
-   for b in string.gfind(bytes, ".") do
-      tensor[i] = string.byte(b)
-      i = i+1
+   local tensor = torch.ByteTensor(self.bytecodesize):zero()
+   if #bytes > 0 then
+      local size = math.min(#bytes, self.bytecodesize)
+      local data = torch.ByteTensor(torch.ByteStorage():string(bytes:sub(1, size)))
+      tensor:narrow(1, 1, size):copy(data)
    end
 
    return tensor
@@ -507,12 +723,126 @@ end
 -- transmit tensor
 --
 function NeuFlow:copyToDev(tensor)
-   self.ethernet:host_copyToDev(tensor)
+   if self.pipeline and self.pipeline.in_flight then
+      -- pipelined loop: the device sends the outputs of the previous frame first
+      self.pipeline.staged = {}
+      for _,output in ipairs(self.pipeline.outputs) do
+         self:receiveOutput(output)
+         table.insert(self.pipeline.staged, output)
+      end
+   end
+   self.profiler:newFrame()
+   -- inputs are sent in the format the bytecode expects, in order
+   local inputs = {}
+   for _,stream in ipairs(self.host_streams) do
+      if stream.tag == 'input' then table.insert(inputs, stream) end
+   end
+   local type
+   if #inputs > 0 then
+      self.next_input = (self.next_input or 0) % #inputs + 1
+      type = inputs[self.next_input].type
+   end
+   self.ethernet:host_copyToDev(tensor, type)
+   if self.pipeline then
+      self.pipeline.in_flight = true
+   end
 end
 
 ----------------------------------------------------------------------
 -- receive tensor
 --
 function NeuFlow:copyFromDev(tensor)
-   self.ethernet:host_copyFromDev(tensor, self.handshake)
+   if self.pipeline then
+      -- pipelined loop: returns the outputs of the previous frame, if any
+      local staged = table.remove(self.pipeline.staged, 1)
+      if not staged then
+         return false
+      end
+      tensor:copy(staged)
+      return true
+   end
+   self:receiveOutput(tensor)
+end
+
+-- outputs are received in the order of the copyToHost() calls
+function NeuFlow:receiveOutput(tensor)
+   local outputs = {}
+   for _,stream in ipairs(self.host_streams) do
+      if stream.tag == 'output' then table.insert(outputs, stream) end
+   end
+   local stream
+   if #outputs > 0 then
+      self.next_output = (self.next_output or 0) % #outputs + 1
+      stream = outputs[self.next_output]
+   end
+
+   if stream and stream.type == 'packed' then
+      -- one stream, one slot per map
+      local slot = packedSlot(stream.h, stream.w)
+      local buffer = torch.Tensor(1, packedSize(stream.n, stream.h, stream.w))
+      self.ethernet:host_copyFromDev(buffer, self.handshake)
+      for i = 1,tensor:size(1) do
+         tensor[i]:copy(buffer[1]:narrow(1, (i-1)*slot + 1, tensor[i]:nElement()))
+      end
+   else
+      self.ethernet:host_copyFromDev(tensor, self.handshake)
+   end
+   self:receiveTrace()
+end
+
+----------------------------------------------------------------------
+-- receive the device trace that follows an output, and merge it into
+-- the profiler: the device clock is aligned on the host by matching
+-- the start of 'copy-to-host' with the end of 'on-board-processing'
+--
+function NeuFlow:receiveTrace()
+   local trace = self.core.trace
+   if not trace then return end
+   trace.next_flush = (trace.next_flush or 0) % #trace.flushes + 1
+   local count = trace.flushes[trace.next_flush]
+
+   local buffer = torch.Tensor(1, trace.size, 12)
+   self.ethernet:host_receiveTrace(buffer, self.handshake)
+
+   -- Q8.8 values back to words, then records
+   local times = {}
+   for slot = 1,trace.size do
+      local words = {}
+      for j = 1,12 do
+         words[j] = math.floor(buffer[1][slot][j] * num.one + 0.5) % 65536
+      end
+      local id = words[1] + words[2]*65536
+      local digits = {}
+      for j = 3,11 do
+         digits[j-2] = words[j] % 256
+      end
+      local ticks = tonumber(string.char(unpack(digits)))
+      -- records of later events belong to the previous frame
+      if id >= 1 and id <= count and ticks then
+         times[id] = ticks * self.core.period_ns * 1e-9
+      end
+   end
+
+   -- pair begin/end events into spans
+   local spans = {}
+   local open = {}
+   for id = 1,count do
+      local event = trace.events[id]
+      if times[id] then
+         if event.kind == 'begin' then
+            open[event.name] = times[id]
+         elseif open[event.name] then
+            table.insert(spans, {name = event.name, start = open[event.name], stop = times[id]})
+            open[event.name] = nil
+         end
+      end
+   end
+
+   local anchor
+   for _,span in ipairs(spans) do
+      if span.name == 'copy-to-host' then
+         anchor = span.start
+      end
+   end
+   self.profiler:mergeDeviceTrace(spans, anchor, 'on-board-processing')
 end
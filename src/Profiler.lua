@@ -1,27 +1,64 @@
 --------------------------------------------------------------------------------
 -- Profiler: a simple class to help profiling code
+--
+-- Each event keeps its last lap (cpud, reald), and the distribution of
+-- its real times in a log-spaced histogram of fixed size: percentiles
+-- are read from the histogram. When an event reaches 'window' samples,
+-- its histogram is halved, so the distribution follows recent frames.
+--
+-- Events started while another one is running are nested in it. Laps
+-- (and device spans, see mergeDeviceTrace()) are recorded in the
+-- timeline of the current frame; newFrame() closes it.
 --------------------------------------------------------------------------------
 local Profiler = torch.class('neuflow.Profiler')
 
-function Profiler:__init(mode,verbose)
+-- histogram: 'bins_per_decade' bins, from 'hist_min' to 'hist_max' seconds
+local hist_min = 1e-7
+local hist_max = 1e3
+local bins_per_decade = 20
+local nb_bins = math.log10(hist_max/hist_min) * bins_per_decade
+local log_min = math.log10(hist_min)
+
+local function bin(value)
+   if value <= hist_min then return 1 end
+   local b = math.floor((math.log10(value) - log_min) * bins_per_decade) + 1
+   if b > nb_bins then return nb_bins end
+   return b
+end
+
+function Profiler:__init(mode,verbose,window)
    self.events = {}
    self.list = {}
    self.off = (mode == 'off') or false
    self.verbose = verbose or false
+   self.window = window or 10000
+   -- running events, outermost first
+   self.stack = {}
+   -- timeline of the current frame, and past frames
+   self.frame = 1
+   self.timeline = {frame = self.frame}
+   self.frames = {}
+   self.max_frames = 100
+   self.max_spans = 1000
+   self.origin = sys.clock()
+end
+
+function Profiler:create(name)
+   local event = {name=name, count=0, sum=0, hist={}, hist_count=0}
+   self.events[name] = event
+   self.list[#self.list+1] = event
+   return event
 end
 
 function Profiler:start(name, fps)
-   if self.events[name] then
-      -- update
-      self.events[name].cpu = os.clock()
-      self.events[name].real = sys.clock()
-   else
-      -- create
-      self.events[name] = {cpu=os.clock(), real=sys.clock(), name=name}
-      self.list[#self.list+1] = self.events[name]
-   end
+   local event = self.events[name] or self:create(name)
+   event.depth = #self.stack
+   event.parent = self.stack[#self.stack]
+   self.stack[#self.stack+1] = name
+   event.cpu = os.clock()
+   event.real = sys.clock()
    if fps and fps == 'fps' then
-      self.events[name].fps = true
+      event.fps = true
    end
    if self.verbose then io.write('<' .. name .. '>') io.flush() end
 end
@@ -44,19 +81,153 @@ function Profiler:cpu(name,divider)
 end
 
 function Profiler:real(name,divider)
-   local delta = sys.clock() - self.events[name].real
+   local stop = sys.clock()
+   local delta = stop - self.events[name].real
    if divider then delta = delta / divider end
    self.events[name].reald = delta
+   self.events[name].stop = stop
    return delta
 end
 
+-- adds a sample to the distribution of an event
+function Profiler:record(event, value)
+   event.count = event.count + 1
+   event.sum = event.sum + value
+   if not event.min or value < event.min then event.min = value end
+   if not event.max or value > event.max then event.max = value end
+   local b = bin(value)
+   event.hist[b] = (event.hist[b] or 0) + 1
+   event.hist_count = event.hist_count + 1
+   if event.hist_count >= self.window then
+      event.hist_count = 0
+      for k,v in pairs(event.hist) do
+         event.hist[k] = math.floor(v/2)
+         event.hist_count = event.hist_count + event.hist[k]
+      end
+   end
+end
+
+-- adds a span to the timeline of the current frame
+function Profiler:span(source, name, start, stop, depth)
+   local timeline = self.timeline
+   if #timeline >= self.max_spans then
+      -- no frame boundary: the oldest spans are dropped
+      table.remove(timeline, 1)
+   end
+   timeline[#timeline+1] = {source=source, name=name, start=start, stop=stop, depth=depth or 0}
+end
+
 function Profiler:lap(name,divider)
    local r = self:real(name,divider)
    local c = self:cpu(name,divider)
+   local event = self.events[name]
+   self:record(event, r)
+   self:span('host', name, event.real, event.stop, event.depth)
+   -- close the event, and the ones nested in it
+   for i = #self.stack,1,-1 do
+      if self.stack[i] == name then
+         for j = #self.stack,i,-1 do self.stack[j] = nil end
+         break
+      end
+   end
    if self.verbose then io.write('\r') self:print(name) end
    return r,c
 end
 
+-- closes the timeline of the current frame, and starts a new one
+function Profiler:newFrame()
+   table.sort(self.timeline, function(a,b) return a.start < b.start end)
+   table.insert(self.frames, self.timeline)
+   if #self.frames > self.max_frames then
+      table.remove(self.frames, 1)
+   end
+   self.frame = self.frame + 1
+   self.timeline = {frame = self.frame}
+   return self.frame
+end
+
+-- merges the spans measured on the device ({name, start, stop}, in
+-- seconds from the device frame origin) into the current frame. The
+-- device time 'anchor' is aligned on the end of the host event
+-- 'host_event'; without anchor, the last device span is aligned on the
+-- present time.
+function Profiler:mergeDeviceTrace(spans, anchor, host_event)
+   local offset
+   local event = self.events[host_event or '']
+   if anchor and event and event.stop then
+      offset = event.stop - anchor
+   else
+      local last = 0
+      for _,span in ipairs(spans) do
+         last = math.max(last, span.stop)
+      end
+      offset = sys.clock() - last
+   end
+
+   -- spans are nested in the spans that enclose them
+   table.sort(spans, function(a,b) return a.start < b.start end)
+   local open = {}
+   for _,span in ipairs(spans) do
+      local name = 'dev:' .. span.name
+      local event = self.events[name]
+      if not event then
+         event = self:create(name)
+         event.color = 'red'
+      end
+      event.reald = span.stop - span.start
+      self:record(event, event.reald)
+      while #open > 0 and open[#open].stop <= span.start do
+         open[#open] = nil
+      end
+      self:span('device', span.name, span.start + offset, span.stop + offset, #open)
+      open[#open+1] = span
+   end
+end
+
+-- p-th percentile (0 < p <= 100) of the real times of an event
+function Profiler:percentile(name, p)
+   local event = self.events[name]
+   if not event or event.hist_count == 0 then return nil end
+   local target = math.max(1, math.ceil(event.hist_count * p / 100))
+   local seen = 0
+   for b = 1,nb_bins do
+      seen = seen + (event.hist[b] or 0)
+      if seen >= target then
+         -- geometric center of the bin
+         local value = 10^(log_min + (b - 0.5)/bins_per_decade)
+         return math.min(math.max(value, event.min), event.max)
+      end
+   end
+   return event.max
+end
+
+function Profiler:stats(name)
+   local event = self.events[name]
+   if not event or event.count == 0 then return nil end
+   return {
+      count = event.count,
+      mean = event.sum / event.count,
+      min = event.min,
+      max = event.max,
+      p50 = self:percentile(name, 50),
+      p95 = self:percentile(name, 95),
+      p99 = self:percentile(name, 99)
+   }
+end
+
+function Profiler:formatTimeline(frame)
+   frame = frame or self.frames[#self.frames] or self.timeline
+   local str = '$ timeline [frame ' .. (frame.frame or '?') .. ']:'
+   local origin = frame[1] and frame[1].start or 0
+   for _,entry in ipairs(frame) do
+      str = str .. '\n' .. string.format('$ %-6s %10.3f ms %10.3f ms %s<%s>', entry.source,
+                                         (entry.start - origin)*1e3,
+                                         (entry.stop - entry.start)*1e3,
+                                         string.rep('  ', entry.depth), entry.name)
+   end
+   return str
+end
+
 function Profiler:format(name)
    return string.format('$ real | cpu: %f | %f <%s>',
                         self.events[name].reald or -1, self.events[name].cpud or -1, name)
@@ -68,20 +239,26 @@ function Profiler:print(name)
    end
 end
 
+local function formatEvent(event)
+   local str = string.format('$ real %f | cpu %f %s<%s>',
+                             event.reald or -1,
+                             event.cpud or -1,
+                             string.rep('  ', event.depth or 0),
+                             event.name)
+   if event.fps then
+      str = str .. string.format(' = %f fps', 1/event.reald)
+   end
+   return str
+end
+
 function Profiler:formatAll()
    local str = '$ profiler report:'
    for i = 1,#self.list do
-      if self.list[i].fps then
-         str = str .. '\n' .. string.format('$ real %f | cpu %f <%s> = %f fps',
-                                            self.list[i].reald or -1,
-                                            self.list[i].cpud or -1,
-                                            self.list[i].name,
-                                            1/self.list[i].reald)
-      else
-         str = str .. '\n' .. string.format('$ real %f | cpu %f <%s>',
-                                            self.list[i].reald or -1,
-                                            self.list[i].cpud or -1,
-                                            self.list[i].name)
+      str = str .. '\n' .. formatEvent(self.list[i])
+      local stats = self:stats(self.list[i].name)
+      if stats and stats.count > 1 then
+         str = str .. string.format(' [n %d | p50 %f | p95 %f | p99 %f]',
+                                    stats.count, stats.p50, stats.p95, stats.p99)
       end
    end
    return str
@@ -93,6 +270,50 @@ function Profiler:printAll()
    end
 end
 
+----------------------------------------------------------------------
+-- exports:
+--   exportChromeTrace() writes the timelines of the past frames in the
+--     trace event format (chrome://tracing, one row per source)
+--   exportCSV() writes one line of statistics per event, in seconds
+--
+function Profiler:exportChromeTrace(filename)
+   local file = assert(io.open(filename, 'w'))
+   local pids = {host = 1, device = 2}
+   file:write('{"traceEvents":[\n')
+   file:write('{"name":"process_name","ph":"M","pid":1,"args":{"name":"host"}},\n')
+   file:write('{"name":"process_name","ph":"M","pid":2,"args":{"name":"neuFlow"}}')
+   local frames = {}
+   for _,frame in ipairs(self.frames) do frames[#frames+1] = frame end
+   if #self.timeline > 0 then frames[#frames+1] = self.timeline end
+   for _,frame in ipairs(frames) do
+      for _,entry in ipairs(frame) do
+         file:write(string.format(',\n{"name":"%s","cat":"%s","ph":"X","ts":%.3f,"dur":%.3f,'
+                                  .. '"pid":%d,"tid":%d,"args":{"frame":%d}}',
+                                  (entry.name:gsub('["\\]', '\\%0')), entry.source,
+                                  (entry.start - self.origin)*1e6,
+                                  (entry.stop - entry.start)*1e6,
+                                  pids[entry.source] or 3, entry.depth, frame.frame or 0))
+      end
+   end
+   file:write('\n]}\n')
+   file:close()
+end
+
+function Profiler:exportCSV(filename)
+   local file = assert(io.open(filename, 'w'))
+   file:write('name,count,last,mean,min,p50,p95,p99,max\n')
+   for i = 1,#self.list do
+      local name = self.list[i].name
+      local stats = self:stats(name)
+      if stats then
+         file:write(string.format('"%s",%d,%g,%g,%g,%g,%g,%g,%g\n', name, stats.count,
+                                  self.list[i].reald, stats.mean, stats.min,
+                                  stats.p50, stats.p95, stats.p99, stats.max))
+      end
+   end
+   file:close()
+end
+
 function Profiler:displayAll(args)
    -- args
    local x = args.x or 0
@@ -106,19 +327,7 @@ function Profiler:displayAll(args)
    if not self.off then
       for i = 1,#self.list do
          painter:setcolor(self.list[i].color or "black")
-         local str
-         if self.list[i].fps then
-            str = string.format('$ real %f | cpu %f <%s> = %f fps',
-                                self.list[i].reald or -1,
-                                self.list[i].cpud or -1,
-                                self.list[i].name,
-                                1/self.list[i].reald)
-         else
-            str = string.format('$ real %f | cpu %f <%s>',
-                                self.list[i].reald or -1,
-                                self.list[i].cpud or -1,
-                                self.list[i].name)
-         end
+         local str = formatEvent(self.list[i])
          -- disp line:
          painter:moveto(x,y); y = y + font*1.5
          painter:show(str)
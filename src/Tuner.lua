@@ -0,0 +1,180 @@
+----------------------------------------------------------------------
+--- Class: Tuner
+--
+-- This class searches the compile options of a network, for a given
+-- input size, and keeps the best ones in a database (a file in
+-- neuflow.tunepath). NeuFlow:compile() looks the database up before
+-- compiling.
+--
+-- A candidate is evaluated either by the static performance model
+-- (the network is compiled on a fresh Core, see Estimator), or by a
+-- user function measure(options), which returns the time of a frame
+-- measured on flowsim or on the device. The options the static model
+-- does not see (config caching, Ethernet sleeps) are only searched
+-- when measuring.
+--
+-- The search is a coordinate descent: each option in turn is set to
+-- its best value, the others being fixed, until nothing improves.
+--
+local Tuner = torch.class('neuflow.Tuner')
+
+-- compile options, and the values searched (the first one is the default)
+local options = {
+   {name = 'optimize_across_layers', values = {true, false}, static = true},
+   {name = 'conv_group', static = true}, -- grid.nb_convs .. 1
+   {name = 'packing', values = {'auto', '1D'}, static = true},
+   {name = 'cache_config', values = {false, true}},
+   {name = 'sleep_threshold_b', values = {30*30*2, 0, 64*64*2}}
+}
+
+local function values(option)
+   if option.name == 'conv_group' then
+      local list = {}
+      for n = grid.nb_convs,1,-1 do table.insert(list, n) end
+      return list
+   end
+   return option.values
+end
+
+local function defaults()
+   local opts = {}
+   for _,option in ipairs(options) do
+      opts[option.name] = values(option)[1]
+   end
+   return opts
+end
+
+local function describe(opts)
+   local str = {}
+   for _,option in ipairs(options) do
+      table.insert(str, option.name .. '=' .. tostring(opts[option.name]))
+   end
+   return table.concat(str, ' ')
+end
+
+-- structure of a network: module types, and weight sizes
+local function signature(module)
+   local str = torch.typename(module) or '?'
+   if module.modules then
+      local subs = {}
+      for i,sub in ipairs(module.modules) do
+         subs[i] = signature(sub)
+      end
+      str = str .. '(' .. table.concat(subs, ',') .. ')'
+   elseif module.weight then
+      str = str .. '[' .. table.concat(module.weight:size():totable(), 'x') .. ']'
+   end
+   return str
+end
+
+function Tuner:__init(args)
+   -- args:
+   self.args = args.args or {} -- args of the Core (platform, sizes ...)
+   self.db_file = args.db or (neuflow.tunepath .. '/options.db')
+   self.measure = args.measure
+   self.max_sweeps = args.max_sweeps or 2
+   self.msg_level = args.msg_level or 'concise'
+end
+
+function Tuner:key(network, inputs)
+   return string.format('%s %dx%dx%d %s', self.args.platform or 'generic',
+                        #inputs, inputs[1].orig_h, inputs[1].orig_w, signature(network))
+end
+
+function Tuner:load()
+   if not self.db then
+      if paths.filep(self.db_file) then
+         self.db = torch.load(self.db_file, 'ascii')
+      else
+         self.db = {}
+      end
+   end
+   return self.db
+end
+
+function Tuner:save()
+   torch.save(self.db_file, self:load(), 'ascii')
+end
+
+-- the best options known for this network and input size, or nil
+function Tuner:lookup(network, inputs)
+   local entry = self:load()[self:key(network, inputs)]
+   if entry then
+      -- options added since the entry was stored keep their default
+      local opts = defaults()
+      for name,value in pairs(entry.options) do
+         opts[name] = value
+      end
+      return opts, entry
+   end
+end
+
+-- predicted time of a frame, compiled with the given options
+function Tuner:estimate(network, inputs, opts)
+   local args = {}
+   for k,v in pairs(self.args) do args[k] = v end
+   args.msg_level = 'none'
+   args.conv_group = opts.conv_group
+   args.packing = opts.packing
+   args.cache_config = opts.cache_config
+
+   local core = neuflow.Core(args)
+   local compiler = neuflow.Compiler {
+      optimize_across_layers = opts.optimize_across_layers,
+      core = core,
+      msg_level = 'none'
+   }
+   local segments = {}
+   for i,input in ipairs(inputs) do
+      segments[i] = core.mem:allocManagedData(torch.Tensor(input.orig_h, input.orig_w))
+   end
+   core.estimator:hostTransfer('host->dev', segments)
+   local outputs = compiler:processNetwork(network, segments)
+   return core.estimator:total(outputs)
+end
+
+-- searches the options, and stores the best ones
+function Tuner:tune(network, inputs)
+   local method = (self.measure and 'measured') or 'estimated'
+   local times = {}
+   local function evaluate(opts)
+      local desc = describe(opts)
+      if not times[desc] then
+         if self.measure then
+            times[desc] = self.measure(opts)
+         else
+            times[desc] = self:estimate(network, inputs, opts)
+         end
+         if self.msg_level ~= 'none' then
+            print(string.format('<neuflow.Tuner> %s: %.3f ms', desc, times[desc]*1e3))
+         end
+      end
+      return times[desc]
+   end
+
+   local best = defaults()
+   local best_s = evaluate(best)
+   for sweep = 1,self.max_sweeps do
+      local improved = false
+      for _,option in ipairs(options) do
+         if option.static or self.measure then
+            for _,value in ipairs(values(option)) do
+               local candidate = {}
+               for k,v in pairs(best) do candidate[k] = v end
+               candidate[option.name] = value
+               local time_s = evaluate(candidate)
+               if time_s < best_s then
+                  best, best_s, improved = candidate, time_s, true
+               end
+            end
+         end
+      end
+      if not improved then break end
+   end
+
+   self:load()[self:key(network, inputs)] = {options = best, time_s = best_s, method = method}
+   self:save()
+   print(string.format('<neuflow.Tuner> best options (%s, %.3f ms): %s',
+                       method, best_s*1e3, describe(best)))
+   return best
+end
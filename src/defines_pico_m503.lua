@@ -61,6 +61,7 @@ blast_bus = {
    instruc_deActivate  = 3,
    instruc_reset       = 4,
    instruc_RESERVED_1  = 5,
+   instruc_pulseToggleControls = 5, -- RESERVED_1, as sent by send_pulseToggleControls
    instruc_control_0   = 6,
    instruc_control_1   = 7,
    instruc_control_2   = 8,
@@ -249,6 +250,11 @@ do
    memory.bandwidth_  = memory.bus_*memory.clock_freq*((memory.is_ddr and 2) or 1)
    memory.bandwidth_b = memory.bandwidth_ / 8
    memory.bandwidth_w = memory.bandwidth_b / streamer.word_b
+   -- geometry: pages (DRAM rows) are interleaved over the banks
+   memory.nb_banks    = 8
+   memory.nb_cols     = 1024
+   memory.page_b      = memory.nb_cols * memory.bus_ / 8
+   memory.page_w      = memory.page_b / streamer.word_b
 
    memory.offset_text = 0
 end
@@ -319,6 +325,20 @@ do
 end
 
 
+----------------------------------------------------------------------
+--- Host link parameters
+--
+host = {}
+do
+   -- raw link rate: PCIe x8 (gen1, after 8b/10b encoding)
+   host.link_rate_   = 8*2000*MHz
+   -- 0.8 is an empirical throughput factor (headers, descriptors, acks)
+   host.bandwidth_b  = host.link_rate_ / 8 * 0.8
+   -- fixed cost per transfer (descriptor + handshake)
+   host.latency_s    = 100e-6
+end
+
+
 ----------------------------------------------------------------------
 --- System Banner
 --
@@ -38,6 +38,7 @@ require 'bit'
 
 -- main table
 neuflow = {}
+neuflow.version = '1.scm-0'
 
 -- load all submodules
 torch.include('neuflow', 'defines.lua')
@@ -46,7 +47,9 @@ torch.include('neuflow', 'rom.lua')
 torch.include('neuflow', 'Profiler.lua')
 torch.include('neuflow', 'Log.lua')
 torch.include('neuflow', 'Memory.lua')
+torch.include('neuflow', 'Estimator.lua')
 torch.include('neuflow', 'Compiler.lua')
+torch.include('neuflow', 'Tuner.lua')
 torch.include('neuflow', 'Interface.lua')
 torch.include('neuflow', 'DmaInterface.lua')
 torch.include('neuflow', 'Camera.lua')
@@ -66,6 +69,10 @@ neuflow.coefpath = os.getenv('HOME')..'/.neuflow/coefs'
 os.execute('mkdir -p ' .. neuflow.coefpath)
 os.execute('chmod a+rw ' .. neuflow.coefpath)
 
+-- and the database of tuned compile options
+neuflow.tunepath = os.getenv('HOME')..'/.neuflow/tune'
+os.execute('mkdir -p ' .. neuflow.tunepath)
+
 -- migrate all the coefficients
 os.execute('cp ' ..  sys.concat(sys.fpath(), 'coef_*') .. ' ' .. neuflow.coefpath)
 os.execute('chmod a+rw ' .. neuflow.coefpath .. '/*')
@@ -128,6 +128,192 @@ function neuflow.tools.readBinWriteRom(input, output, word_width, name)
 end
 
 
+----------------------------------------------------------------------
+--- bytecode container.
+-- A container holds a compiled program and everything needed to load it
+-- without parsing: a one-page header (format version, compiler version,
+-- platform, sizes, checksum, section table), a host metadata section
+-- (stream tags and shapes), and the bytecode image. Sections are page
+-- aligned, so that a loader can mmap the file and hand the image to the
+-- transport as is. The image section spans the whole bootloader load
+-- size: the zero tail is left as a hole (sparse file), and is never
+-- written. 'instructions' and 'embedded' are views into the image.
+--
+neuflow.tools.container = {
+   magic = 'NFBC',
+   version = 1,
+   page_b = 4096,
+   name_b = 16,
+   string_b = 64
+}
+
+-- adler32 of the first n bytes of a ByteTensor, computed by chunks with
+-- tensor ops (partial sums must stay exact in double precision)
+function neuflow.tools.adler32(bytes, n)
+   local mod = 65521
+   local chunk = 65536
+   local ramp = torch.range(1, chunk)
+   local a = 1
+   local b = n % mod
+   for offset = 0,n-1,chunk do
+      local m = math.min(chunk, n - offset)
+      local data = torch.Tensor(m):copy(bytes:narrow(1, offset+1, m))
+      local sum = data:sum()
+      local weighted = data:dot(ramp:narrow(1, 1, m))
+      a = (a + sum) % mod
+      b = (b + ((n - offset + 1) % mod) * (sum % mod) - weighted) % mod
+   end
+   return a, b
+end
+
+local function fixedString(str, size)
+   str = tostring(str or ''):sub(1, size)
+   return str .. string.rep('\0', size - #str)
+end
+
+local function readFixedString(file, size)
+   local str = file:readChar(size):string()
+   return (str:gsub('%z.*', ''))
+end
+
+function neuflow.tools.writeContainer(filename, args)
+   local format = neuflow.tools.container
+   local image = args.image
+   local image_size = args.image_size
+   local load_size = image:nElement()
+
+   -- host metadata, as text
+   local meta = {}
+   for i,stream in ipairs(args.streams or {}) do
+      -- the type is optional (inputs: element type, outputs: 'packed')
+      table.insert(meta, string.format('stream %d %s %d %d %d %s', i, stream.tag,
+                                       stream.n, stream.h, stream.w, stream.type or ''))
+   end
+   meta = table.concat(meta, '\n') .. '\n'
+
+   -- layout: header, meta, image
+   local function align(offset)
+      return math.ceil(offset / format.page_b) * format.page_b
+   end
+   local meta_offset = format.page_b
+   local image_offset = align(meta_offset + #meta)
+   local sections = {
+      {name = 'meta', offset = meta_offset, size = #meta},
+      {name = 'image', offset = image_offset, size = load_size},
+      {name = 'instructions', offset = image_offset, size = args.instructions_size},
+      {name = 'embedded', offset = image_offset + args.embedded_offset,
+       size = image_size - args.embedded_offset}
+   }
+
+   local checksum_a, checksum_b = neuflow.tools.adler32(image, image_size)
+
+   print('<neuflow.tools> writing bytecode container [' .. filename .. ']: '
+         .. image_size .. ' bytes used, ' .. load_size .. ' bytes mapped')
+
+   local file = assert(torch.DiskFile(filename, 'w'):binary())
+   file:writeString(format.magic)
+   file:writeInt(format.version)
+   file:writeInt(image_size)
+   file:writeInt(load_size)
+   file:writeInt(checksum_a)
+   file:writeInt(checksum_b)
+   file:writeString(fixedString(args.platform, format.string_b))
+   file:writeString(fixedString('neuflow-' .. neuflow.version, format.string_b))
+   file:writeString(fixedString(args.prog_name, format.string_b))
+   file:writeInt(#sections)
+   for _,section in ipairs(sections) do
+      file:writeString(fixedString(section.name, format.name_b))
+      file:writeInt(section.offset)
+      file:writeInt(section.size)
+   end
+
+   -- meta
+   file:seek(meta_offset + 1)
+   file:writeString(meta)
+
+   -- image: only the used part is written, the file is then extended to
+   -- the full load size by its last byte
+   file:seek(image_offset + 1)
+   if image_size > 0 then
+      file:writeByte(torch.ByteTensor(image_size):copy(image:narrow(1, 1, image_size)):storage())
+   end
+   file:seek(image_offset + load_size)
+   file:writeByte(0)
+   assert(file:close())
+end
+
+-- returns nil if the file is not a container
+function neuflow.tools.readContainer(filename)
+   local format = neuflow.tools.container
+   local file = assert(torch.DiskFile(filename, 'r'):binary())
+   file:seekEnd()
+   if file:position() - 1 <= format.page_b then
+      file:close()
+      return nil
+   end
+   file:seek(1)
+   if file:readChar(#format.magic):string() ~= format.magic then
+      file:close()
+      return nil
+   end
+
+   local container = {}
+   container.version = file:readInt()
+   if container.version > format.version then
+      file:close()
+      error('<neuflow.tools> ERROR: container format v' .. container.version
+            .. ' is not supported (max v' .. format.version .. ')')
+   end
+   container.image_size = file:readInt()
+   container.load_size = file:readInt()
+   local checksum_a = file:readInt()
+   local checksum_b = file:readInt()
+   container.platform = readFixedString(file, format.string_b)
+   container.compiler = readFixedString(file, format.string_b)
+   container.prog_name = readFixedString(file, format.string_b)
+   local sections = {}
+   for i = 1,file:readInt() do
+      local name = readFixedString(file, format.name_b)
+      sections[name] = {offset = file:readInt(), size = file:readInt()}
+   end
+
+   -- host metadata
+   container.streams = {}
+   if sections.meta and sections.meta.size > 0 then
+      file:seek(sections.meta.offset + 1)
+      local text = file:readChar(sections.meta.size):string()
+      for line in text:gmatch('[^\n]+') do
+         local i,tag,n,h,w,type = line:match('^stream (%d+) (%S+) (%d+) (%d+) (%d+) ?(%S*)')
+         if i then
+            container.streams[tonumber(i)] = {tag = tag, n = tonumber(n), h = tonumber(h), w = tonumber(w),
+                                              type = (type ~= '' and type) or nil}
+         end
+      end
+   end
+   file:close()
+
+   -- map file, and build zero-copy views of all the sections
+   local storage = torch.ByteStorage(filename, false)
+   container.sections = {}
+   for name,section in pairs(sections) do
+      if section.offset + section.size > storage:size() then
+         error('<neuflow.tools> ERROR: container section [' .. name .. '] is truncated')
+      end
+      if section.size > 0 then
+         container.sections[name] = torch.ByteTensor(storage, section.offset + 1, section.size)
+      end
+   end
+   container.image = container.sections.image
+
+   local a, b = neuflow.tools.adler32(container.image, container.image_size)
+   if a ~= checksum_a or b ~= checksum_b then
+      error('<neuflow.tools> ERROR: container [' .. filename .. '] is corrupted (checksum mismatch)')
+   end
+
+   return container
+end
+
+
 ----------------------------------------------------------------------
 --- helper
 --